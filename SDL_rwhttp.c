@@ -8,6 +8,12 @@
 
 #ifdef HAVE_CURL
 #include <curl/curl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
 #endif
 #if defined(HAVE_SDL_NET) || defined(HAVE_SDL2_NET)
 #include <SDL_net.h>
@@ -21,6 +27,10 @@ static const char *userAgent;
 static int connectTimeout;
 static int timeout;
 static int fetchLimit;
+static int maxHostConnections;
+static size_t streamBuffer;
+static const char *cacheDir;
+static size_t cacheSize;
 static const char *contentLength = "Content-Length: ";
 static const size_t strLength = 16;
 
@@ -31,9 +41,131 @@ static const size_t strLength = 16;
 #endif
 #endif
 
+#ifdef HAVE_CURL
+#define HANDLE_POOL_SIZE 16
+
+static CURLSH *shareHandle;                            /* DNS, connection and TLS session cache */
+static SDL_mutex *shareLocks[CURL_LOCK_DATA_LAST];
+static CURL *handlePool[HANDLE_POOL_SIZE];             /* idle easy handles, guarded by handlePoolLock */
+static int handlePoolCount;
+static SDL_mutex *handlePoolLock;
+static SDL_mutex *cacheLock;                           /* serializes all disk cache file operations */
+static Uint64 cacheUsed;                               /* bytes of cached bodies, guarded by cacheLock */
+static SDL_bool cacheCounted;                          /* whether cacheUsed was counted from the directory */
+
+static int SDL_RWHttpMultiStart (void);
+static void SDL_RWHttpMultiStop (void);
+
+static void SDL_RWHttpShareLock (CURL *handle, curl_lock_data data, curl_lock_access access, void *userData)
+{
+	SDL_LockMutex(shareLocks[data]);
+}
+
+static void SDL_RWHttpShareUnlock (CURL *handle, curl_lock_data data, void *userData)
+{
+	SDL_UnlockMutex(shareLocks[data]);
+}
+
+static int SDL_RWHttpShareStart (void)
+{
+	int i;
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		shareLocks[i] = SDL_CreateMutex();
+		if (shareLocks[i] == NULL) {
+			/* The sdl error is already set */
+			return -1;
+		}
+	}
+	handlePoolLock = SDL_CreateMutex();
+	cacheLock = SDL_CreateMutex();
+	if (handlePoolLock == NULL || cacheLock == NULL) {
+		return -1;
+	}
+
+	shareHandle = curl_share_init();
+	if (shareHandle == NULL) {
+		SDL_SetError("could not create curl share handle");
+		return -1;
+	}
+	curl_share_setopt(shareHandle, CURLSHOPT_LOCKFUNC, SDL_RWHttpShareLock);
+	curl_share_setopt(shareHandle, CURLSHOPT_UNLOCKFUNC, SDL_RWHttpShareUnlock);
+	curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	return 0;
+}
+
+static void SDL_RWHttpShareStop (void)
+{
+	int i;
+
+	while (handlePoolCount > 0) {
+		curl_easy_cleanup(handlePool[--handlePoolCount]);
+	}
+	if (shareHandle) {
+		curl_share_cleanup(shareHandle);
+		shareHandle = NULL;
+	}
+	if (handlePoolLock) {
+		SDL_DestroyMutex(handlePoolLock);
+		handlePoolLock = NULL;
+	}
+	if (cacheLock) {
+		SDL_DestroyMutex(cacheLock);
+		cacheLock = NULL;
+	}
+	for (i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		if (shareLocks[i]) {
+			SDL_DestroyMutex(shareLocks[i]);
+			shareLocks[i] = NULL;
+		}
+	}
+}
+
+/* Returns an idle easy handle from the pool, or a new one if the pool is empty */
+static CURL* SDL_RWHttpCurlAcquire (void)
+{
+	CURL *curl = NULL;
+
+	SDL_LockMutex(handlePoolLock);
+	if (handlePoolCount > 0) {
+		curl = handlePool[--handlePoolCount];
+	}
+	SDL_UnlockMutex(handlePoolLock);
+
+	if (curl) {
+		curl_easy_reset(curl);
+		return curl;
+	}
+	return curl_easy_init();
+}
+
+/* Hands an easy handle back to the pool; its connections stay open in the shared cache */
+static void SDL_RWHttpCurlRelease (CURL *curl)
+{
+	if (!curl) {
+		return;
+	}
+
+	SDL_LockMutex(handlePoolLock);
+	if (handlePoolCount < HANDLE_POOL_SIZE) {
+		handlePool[handlePoolCount++] = curl;
+		curl = NULL;
+	}
+	SDL_UnlockMutex(handlePoolLock);
+
+	if (curl) {
+		curl_easy_cleanup(curl);
+	}
+}
+#endif
+
 int SDL_RWHttpShutdown (void)
 {
 #ifdef HAVE_CURL
+	SDL_RWHttpMultiStop();
+	SDL_RWHttpShareStop();
 	curl_global_cleanup();
 #else
 #if defined(HAVE_SDL_NET) || defined(HAVE_SDL2_NET)
@@ -69,11 +201,42 @@ int SDL_RWHttpInit (void)
 	else
 		fetchLimit = 1024 * 1024 * 30;
 
+	hint = SDL_GetHint(SDL_RWHTTP_HINT_STREAMBUFFER);
+	if (hint)
+		streamBuffer = (size_t)atoi(hint);
+	else
+		streamBuffer = 4 * 1024 * 1024;
+	if (streamBuffer < 256 * 1024)
+		streamBuffer = 256 * 1024;
+
+	hint = SDL_GetHint(SDL_RWHTTP_HINT_MAXHOSTCONNECTIONS);
+	if (hint)
+		maxHostConnections = atoi(hint);
+	else
+		maxHostConnections = 4;
+
+	cacheDir = SDL_GetHint(SDL_RWHTTP_HINT_CACHEDIR);
+	if (cacheDir && cacheDir[0] == '\0')
+		cacheDir = NULL;
+#ifdef HAVE_CURL
+	if (cacheDir)
+		mkdir(cacheDir, 0755);
+#endif
+
+	hint = SDL_GetHint(SDL_RWHTTP_HINT_CACHESIZE);
+	if (hint)
+		cacheSize = (size_t)atoi(hint) * 1024 * 1024;
+	else
+		cacheSize = (size_t)512 * 1024 * 1024;
+
 #ifdef HAVE_CURL
 	{
 		const CURLcode result = curl_global_init(CURL_GLOBAL_ALL);
 		if (result == CURLE_OK) {
-			return 0;
+			if (SDL_RWHttpShareStart() != 0) {
+				return -1;
+			}
+			return SDL_RWHttpMultiStart();
 		}
 		SDL_SetError(curl_easy_strerror(result));
 	}
@@ -97,13 +260,32 @@ typedef struct {
 	char *uri;
 	char *data;
 	size_t size;
+	size_t capacity;
 	size_t expectedSize;
+	int status;                 /* status code of the current response */
+	char *etag;                 /* validators of the current response */
+	char *lastModified;
+	SDL_bool cached;            /* a copy is in the disk cache and the request is conditional */
+	SDL_bool streamed;          /* the body goes to a stream's ring buffer, only the headers are kept */
+	void *requestHeaders;       /* struct curl_slist * with the conditional request headers */
 	void *userData;
 	Uint8 *base;
 	Uint8 *here;
 	Uint8 *stop;
 } http_data_t;
 
+/* Releases everything a http_data_t owns, but not the structure itself */
+static void SDL_RWHttpClearData (http_data_t *httpData)
+{
+	SDL_free(httpData->data);
+	SDL_free(httpData->uri);
+	SDL_free(httpData->etag);
+	SDL_free(httpData->lastModified);
+#ifdef HAVE_CURL
+	curl_slist_free_all((struct curl_slist *)httpData->requestHeaders);
+#endif
+}
+
 #if SDL_VERSION_ATLEAST(2, 0, 0)
 #define SEEK_INT Sint64
 #define READ_INT size_t
@@ -125,9 +307,9 @@ static int http_close (SDL_RWops * context)
 		http_data_t *data = (http_data_t*) context->hidden.unknown.data1;
 #ifdef HAVE_CURL
 		CURL *curl = (CURL*)data->userData;
-		curl_easy_cleanup(curl);
+		SDL_RWHttpCurlRelease(curl);
 #endif
-		SDL_free(data->data);
+		SDL_RWHttpClearData(data);
 		SDL_free(data);
 	}
 	SDL_FreeRW(context);
@@ -199,22 +381,73 @@ static WRITE_INT http_writeconst (SDL_RWops * context, const void *ptr, WRITE_IN
 	return 0;
 }
 
+/* Copies the value of a header line without the line break */
+static char *SDL_RWHttpHeaderValue (const char *header, size_t bytes, size_t nameLength)
+{
+	const char *value = header + nameLength;
+	size_t length = bytes - nameLength;
+	char *copy;
+
+	while (length > 0 && (value[length - 1] == '\r' || value[length - 1] == '\n' || value[length - 1] == ' ')) {
+		length--;
+	}
+	copy = (char*)SDL_malloc(length + 1);
+	if (copy) {
+		SDL_memcpy(copy, value, length);
+		copy[length] = '\0';
+	}
+	return copy;
+}
+
 static size_t SDL_RWHttpHeader (void *headerData, size_t size, size_t nmemb, void *userData)
 {
 	const char *header = (const char *)headerData;
 	const size_t bytes = size * nmemb;
+	http_data_t *httpData = (http_data_t *) userData;
+
+	if (bytes > 5 && !SDL_strncmp(header, "HTTP/", 5)) {
+		/* A new response starts, e.g. after a redirect: forget what the previous one announced */
+		const char *code = SDL_strchr(header, ' ');
+		httpData->status = code ? SDL_atoi(code + 1) : 0;
+		SDL_free(httpData->data);
+		SDL_free(httpData->etag);
+		SDL_free(httpData->lastModified);
+		httpData->data = NULL;
+		httpData->etag = NULL;
+		httpData->lastModified = NULL;
+		httpData->size = 0;
+		httpData->capacity = 0;
+		httpData->expectedSize = 0;
+		return bytes;
+	}
+
+	if (bytes > 6 && !SDL_strncasecmp(header, "ETag: ", 6)) {
+		SDL_free(httpData->etag);
+		httpData->etag = SDL_RWHttpHeaderValue(header, bytes, 6);
+		return bytes;
+	}
+
+	if (bytes > 15 && !SDL_strncasecmp(header, "Last-Modified: ", 15)) {
+		SDL_free(httpData->lastModified);
+		httpData->lastModified = SDL_RWHttpHeaderValue(header, bytes, 15);
+		return bytes;
+	}
 
 	if (bytes <= strLength) {
 		return bytes;
 	}
 
-	if (!SDL_strncasecmp(header, contentLength, strLength)) {
-		http_data_t *httpData = (http_data_t *) userData;
+	/* Only a successful response announces the body we are going to receive */
+	if (httpData->status < 300 && !SDL_strncasecmp(header, contentLength, strLength)) {
 		httpData->expectedSize = SDL_strtoul(header + strLength, NULL, 10);
 		if (httpData->expectedSize == 0) {
 			SDL_SetError("invalid content length given: %i", (int)httpData->expectedSize);
 			return 0;
 		}
+		if (httpData->streamed) {
+			/* A stream only keeps a window of the body, however long it is */
+			return bytes;
+		}
 		if (httpData->expectedSize > fetchLimit) {
 			SDL_SetError("content length exceeded the hardcoded limit of %i (%i)", fetchLimit, (int)httpData->expectedSize);
 			return 0;
@@ -224,26 +457,42 @@ static size_t SDL_RWHttpHeader (void *headerData, size_t size, size_t nmemb, voi
 			SDL_SetError("not enough memory (malloc returned NULL)");
 			return 0;
 		}
+		httpData->capacity = httpData->expectedSize;
 	}
 
 	return bytes;
 }
 
+#define MIN_CHUNKED_CAPACITY (64 * 1024)
+
 static size_t SDL_RWHttpWrite (void *streamData, size_t size, size_t nmemb, void *userData)
 {
 	const size_t realsize = size * nmemb;
 	http_data_t *httpData = (http_data_t *) userData;
 
 	if (httpData->expectedSize == 0) {
-		const int newSize = httpData->size + realsize;
-		if (newSize > fetchLimit) {
+		const size_t newSize = httpData->size + realsize;
+		if (newSize > (size_t)fetchLimit) {
 			SDL_SetError("file exceeded the hardcoded limit of %i (%i)", fetchLimit, (int)newSize);
 			return 0;
 		}
-		httpData->data = (char*)SDL_realloc(httpData->data, newSize);
-		if (httpData->data == NULL) {
-			SDL_SetError("not enough memory (realloc returned NULL)");
-			return 0;
+		if (newSize > httpData->capacity) {
+			/* Without a Content-Length, grow geometrically so the total copying stays linear */
+			size_t newCapacity = SDL_max(httpData->capacity * 2, (size_t)MIN_CHUNKED_CAPACITY);
+			char *newData;
+			if (newCapacity < newSize) {
+				newCapacity = newSize;
+			}
+			if (newCapacity > (size_t)fetchLimit) {
+				newCapacity = fetchLimit;
+			}
+			newData = (char*)SDL_realloc(httpData->data, newCapacity);
+			if (newData == NULL) {
+				SDL_SetError("not enough memory (realloc returned NULL)");
+				return 0;
+			}
+			httpData->data = newData;
+			httpData->capacity = newCapacity;
 		}
 	} else if (httpData->size + realsize > httpData->expectedSize) {
 		SDL_SetError("illegal Content-Length - buffer overflow");
@@ -357,6 +606,274 @@ static int SDL_RWHttpSDLNetDownload (http_data_t *httpData, TCPsocket socket, co
 }
 #endif
 
+#ifdef HAVE_CURL
+/* Builds the path of a disk cache file; entries are named after a hash of their uri,
+   since requests are revalidated per uri and a 304 answer carries no body to hash */
+static void SDL_RWHttpCachePath (char *path, size_t length, const char *uri, const char *extension)
+{
+	Uint64 hash = 14695981039346656037ULL;
+	const char *p;
+
+	for (p = uri; *p; ++p) {
+		hash ^= (Uint8)*p;
+		hash *= 1099511628211ULL;
+	}
+	SDL_snprintf(path, length, "%s/%016llx.%s", cacheDir, (unsigned long long)hash, extension);
+}
+
+/* Reads one line of a cache meta file without the line break */
+static SDL_bool SDL_RWHttpCacheReadLine (FILE *file, char *line, size_t length)
+{
+	size_t end;
+
+	if (!fgets(line, (int)length, file)) {
+		return SDL_FALSE;
+	}
+	end = SDL_strlen(line);
+	while (end > 0 && (line[end - 1] == '\n' || line[end - 1] == '\r')) {
+		line[--end] = '\0';
+	}
+	return SDL_TRUE;
+}
+
+/* Makes the request conditional if a copy of the uri is in the disk cache */
+static void SDL_RWHttpCacheRequest (CURL *curl, http_data_t *httpData)
+{
+	char path[PATH_MAX];
+	char uri[4096];
+	char etag[1024];
+	char lastModified[256];
+	char header[1100];
+	struct curl_slist *headers = NULL;
+	FILE *meta;
+	int valid;
+
+	if (!cacheDir || !httpData->uri) {
+		return;
+	}
+
+	SDL_LockMutex(cacheLock);
+	SDL_RWHttpCachePath(path, sizeof(path), httpData->uri, "meta");
+	meta = fopen(path, "r");
+	if (!meta) {
+		SDL_UnlockMutex(cacheLock);
+		return;
+	}
+	valid = SDL_RWHttpCacheReadLine(meta, uri, sizeof(uri))
+		&& SDL_RWHttpCacheReadLine(meta, etag, sizeof(etag))
+		&& SDL_RWHttpCacheReadLine(meta, lastModified, sizeof(lastModified))
+		&& !SDL_strcmp(uri, httpData->uri);
+	fclose(meta);
+	SDL_UnlockMutex(cacheLock);
+
+	if (!valid) {
+		return;
+	}
+
+	httpData->cached = SDL_TRUE;
+	if (etag[0] != '\0') {
+		SDL_snprintf(header, sizeof(header), "If-None-Match: %s", etag);
+		headers = curl_slist_append(headers, header);
+	}
+	if (lastModified[0] != '\0') {
+		SDL_snprintf(header, sizeof(header), "If-Modified-Since: %s", lastModified);
+		headers = curl_slist_append(headers, header);
+	}
+	httpData->requestHeaders = headers;
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+}
+
+/* Replaces the downloaded data with the cached body; called with cacheLock held */
+static int SDL_RWHttpCacheLoad (http_data_t *httpData)
+{
+	char path[PATH_MAX];
+	FILE *body;
+	long length;
+	char *data;
+
+	SDL_RWHttpCachePath(path, sizeof(path), httpData->uri, "body");
+	body = fopen(path, "rb");
+	if (!body) {
+		return -1;
+	}
+	if (fseek(body, 0, SEEK_END) != 0 || (length = ftell(body)) <= 0 || fseek(body, 0, SEEK_SET) != 0) {
+		fclose(body);
+		return -1;
+	}
+	data = (char*)SDL_malloc(length);
+	if (!data || fread(data, 1, length, body) != (size_t)length) {
+		SDL_free(data);
+		fclose(body);
+		return -1;
+	}
+	fclose(body);
+
+	/* Mark the entry as recently used for pruning */
+	utime(path, NULL);
+
+	SDL_free(httpData->data);
+	httpData->data = data;
+	httpData->size = length;
+	httpData->capacity = length;
+	return 0;
+}
+
+typedef struct {
+	char name[32];
+	off_t size;
+	time_t used;
+} http_cache_entry_t;
+
+static int SDL_RWHttpCacheCompare (const void *a, const void *b)
+{
+	const http_cache_entry_t *left = (const http_cache_entry_t *)a;
+	const http_cache_entry_t *right = (const http_cache_entry_t *)b;
+	return left->used < right->used ? -1 : (left->used > right->used ? 1 : 0);
+}
+
+/* Counts the size of the cache and deletes the least recently used entries until it
+   fits; called with cacheLock held */
+static void SDL_RWHttpCachePrune (void)
+{
+	http_cache_entry_t *entries = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	Uint64 total = 0;
+	struct dirent *entry;
+	size_t i;
+	DIR *dir = opendir(cacheDir);
+
+	if (!dir) {
+		return;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		char path[PATH_MAX];
+		struct stat info;
+		const size_t length = SDL_strlen(entry->d_name);
+
+		if (length < 5 || length >= sizeof(entries->name) || SDL_strcmp(entry->d_name + length - 5, ".body")) {
+			continue;
+		}
+		SDL_snprintf(path, sizeof(path), "%s/%s", cacheDir, entry->d_name);
+		if (stat(path, &info) != 0) {
+			continue;
+		}
+		if (count == capacity) {
+			http_cache_entry_t *grown;
+			capacity = capacity ? capacity * 2 : 64;
+			grown = (http_cache_entry_t*)SDL_realloc(entries, capacity * sizeof(*entries));
+			if (!grown) {
+				break;
+			}
+			entries = grown;
+		}
+		SDL_strlcpy(entries[count].name, entry->d_name, sizeof(entries->name));
+		entries[count].size = info.st_size;
+		entries[count].used = info.st_mtime;
+		total += info.st_size;
+		count++;
+	}
+	closedir(dir);
+
+	if (total > cacheSize) {
+		qsort(entries, count, sizeof(*entries), SDL_RWHttpCacheCompare);
+		for (i = 0; i < count && total > cacheSize; ++i) {
+			char path[PATH_MAX];
+			const size_t length = SDL_strlen(entries[i].name);
+
+			SDL_snprintf(path, sizeof(path), "%s/%s", cacheDir, entries[i].name);
+			unlink(path);
+			SDL_snprintf(path, sizeof(path), "%s/%.*s.meta", cacheDir, (int)(length - 5), entries[i].name);
+			unlink(path);
+			total -= entries[i].size;
+		}
+	}
+	SDL_free(entries);
+
+	cacheUsed = total;
+	cacheCounted = SDL_TRUE;
+}
+
+/* Writes a fresh body and its validators to the disk cache; called with cacheLock held */
+static void SDL_RWHttpCacheStore (http_data_t *httpData)
+{
+	char path[PATH_MAX];
+	char temp[PATH_MAX];
+	FILE *file;
+	int written;
+	struct stat info;
+	Uint64 replaced = 0;
+
+	if (httpData->size == 0 || httpData->size > cacheSize) {
+		return;
+	}
+
+	/* The body goes first, so a meta file never describes a missing or partial body */
+	SDL_RWHttpCachePath(path, sizeof(path), httpData->uri, "body");
+	if (stat(path, &info) == 0) {
+		replaced = info.st_size;
+	}
+	SDL_snprintf(temp, sizeof(temp), "%s.tmp", path);
+	file = fopen(temp, "wb");
+	if (!file) {
+		return;
+	}
+	written = fwrite(httpData->data, 1, httpData->size, file) == httpData->size;
+	written = fclose(file) == 0 && written;
+	if (!written || rename(temp, path) != 0) {
+		unlink(temp);
+		return;
+	}
+	cacheUsed += httpData->size;
+	cacheUsed -= SDL_min(replaced, cacheUsed);
+
+	SDL_RWHttpCachePath(path, sizeof(path), httpData->uri, "meta");
+	SDL_snprintf(temp, sizeof(temp), "%s.tmp", path);
+	file = fopen(temp, "w");
+	if (!file) {
+		return;
+	}
+	fprintf(file, "%s\n%s\n%s\n", httpData->uri, httpData->etag ? httpData->etag : "", httpData->lastModified ? httpData->lastModified : "");
+	if (fclose(file) != 0 || rename(temp, path) != 0) {
+		unlink(temp);
+		return;
+	}
+
+	/* The directory is only scanned once, and then whenever the cache grew too large */
+	if (!cacheCounted || cacheUsed > cacheSize) {
+		SDL_RWHttpCachePrune();
+	}
+}
+
+/* Serves 304 responses and unreachable servers from the disk cache and stores fresh
+   bodies in it; returns the result the transfer should be treated with */
+static CURLcode SDL_RWHttpCacheComplete (CURL *curl, http_data_t *httpData, CURLcode result)
+{
+	long code = 0;
+
+	if (!cacheDir || !httpData->uri) {
+		return result;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+
+	SDL_LockMutex(cacheLock);
+	if (result == CURLE_OK && code == 200) {
+		SDL_RWHttpCacheStore(httpData);
+	} else if (httpData->cached && ((result == CURLE_OK && code == 304) || (result != CURLE_OK && code == 0))) {
+		/* Not modified, or the server could not be reached at all: reuse the local copy */
+		if (SDL_RWHttpCacheLoad(httpData) == 0) {
+			result = CURLE_OK;
+		} else if (result == CURLE_OK) {
+			result = CURLE_READ_ERROR;
+		}
+	}
+	SDL_UnlockMutex(cacheLock);
+
+	return result;
+}
+#endif
+
 static SDL_RWops* SDL_RWHttpCreate (http_data_t *httpData)
 {
 	SDL_RWops *rwops = SDL_AllocRW();
@@ -380,6 +897,37 @@ static SDL_RWops* SDL_RWHttpCreate (http_data_t *httpData)
 	return rwops;
 }
 
+#ifdef HAVE_CURL
+static CURL* SDL_RWHttpCurlCreate (const char *uri, http_data_t *httpData)
+{
+	CURL* curlHandle = SDL_RWHttpCurlAcquire();
+	if (curlHandle == NULL) {
+		return NULL;
+	}
+
+	curl_easy_setopt(curlHandle, CURLOPT_URL, uri);
+	curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, SDL_RWHttpWrite);
+	curl_easy_setopt(curlHandle, CURLOPT_HEADERFUNCTION, SDL_RWHttpHeader);
+	curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, (void * )httpData);
+	curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, (void * )httpData);
+	curl_easy_setopt(curlHandle, CURLOPT_USERAGENT, userAgent);
+	curl_easy_setopt(curlHandle, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(curlHandle, CURLOPT_MAXREDIRS, 5);
+	curl_easy_setopt(curlHandle, CURLOPT_NOPROGRESS, 1);
+	curl_easy_setopt(curlHandle, CURLOPT_FAILONERROR, 1);
+	curl_easy_setopt(curlHandle, CURLOPT_CONNECTTIMEOUT, connectTimeout);
+	curl_easy_setopt(curlHandle, CURLOPT_TIMEOUT, timeout);
+	curl_easy_setopt(curlHandle, CURLOPT_SHARE, shareHandle);
+	curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPIDLE, 60L);
+	curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPINTVL, 30L);
+
+	httpData->userData = curlHandle;
+	return curlHandle;
+}
+#endif
+
 SDL_RWops* SDL_RWFromHttpSync (const char *uri)
 {
 	SDL_RWops *rwops;
@@ -405,27 +953,22 @@ SDL_RWops* SDL_RWFromHttpSync (const char *uri)
 	SDL_zerop(httpData);
 
 #ifdef HAVE_CURL
-	curlHandle = curl_easy_init();
-	curl_easy_setopt(curlHandle, CURLOPT_URL, uri);
-	curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, SDL_RWHttpWrite);
-	curl_easy_setopt(curlHandle, CURLOPT_HEADERFUNCTION, SDL_RWHttpHeader);
-	curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, (void * )httpData);
-	curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, (void * )httpData);
-	curl_easy_setopt(curlHandle, CURLOPT_USERAGENT, userAgent);
-	curl_easy_setopt(curlHandle, CURLOPT_NOSIGNAL, 1);
-	curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1);
-	curl_easy_setopt(curlHandle, CURLOPT_MAXREDIRS, 5);
-	curl_easy_setopt(curlHandle, CURLOPT_NOPROGRESS, 1);
-	curl_easy_setopt(curlHandle, CURLOPT_FAILONERROR, 1);
-	curl_easy_setopt(curlHandle, CURLOPT_CONNECTTIMEOUT, connectTimeout);
-	curl_easy_setopt(curlHandle, CURLOPT_TIMEOUT, timeout);
+	curlHandle = SDL_RWHttpCurlCreate(uri, httpData);
+	if (curlHandle == NULL) {
+		SDL_SetError("could not create curl handle");
+		SDL_free(httpData);
+		return NULL;
+	}
+	httpData->uri = SDL_strdup(uri);
+	SDL_RWHttpCacheRequest(curlHandle, httpData);
 
-	httpData->userData = curlHandle;
 	result = curl_easy_perform(curlHandle);
+	result = SDL_RWHttpCacheComplete(curlHandle, httpData, result);
 	if (result != CURLE_OK) {
 		SDL_SetError(curl_easy_strerror(result));
-		
-		SDL_free(httpData->data);
+
+		SDL_RWHttpCurlRelease(curlHandle);
+		SDL_RWHttpClearData(httpData);
 		SDL_free(httpData);
 		return NULL;
 	}
@@ -477,8 +1020,623 @@ SDL_RWops* SDL_RWFromHttpSync (const char *uri)
 	return rwops;
 }
 
-SDL_RWops* SDL_RWFromHttpAsync (const char *uri)
+#ifdef HAVE_CURL
+/* A download that is read by the decoder while it is still in progress. Only the
+   last streamBuffer bytes are kept, in a ring buffer; the transfer is paused while
+   the buffer is full of data the reader has not read yet. */
+typedef struct {
+	http_data_t httpData;   /* headers only, guarded by lock */
+	SDL_mutex *lock;
+	SDL_cond *changed;      /* signalled whenever data arrives or the transfer ends */
+	Uint8 *ring;            /* byte n of the body is at ring[n % capacity] */
+	size_t capacity;
+	size_t start;           /* offset of the oldest byte still in the ring */
+	size_t end;             /* offset of the byte after the newest one, i.e. the bytes received */
+	size_t position;        /* read position, between start and start + capacity */
+	SDL_bool blocking;      /* whether reads wait for data that has not arrived yet */
+	SDL_bool paused;        /* the transfer is paused until there is room in the ring */
+	SDL_bool resume;        /* the download thread is asked to resume the transfer */
+	SDL_bool done;
+	SDL_bool closed;        /* the reader closed the RWops; the transfer is aborted */
+	int refs;               /* held by the RWops and by the transfer */
+} http_stream_t;
+
+typedef struct http_request_s {
+	http_data_t *httpData;
+	http_stream_t *stream;  /* set for streamed downloads instead of httpData */
+	CURL *curl;
+	SDL_RWHttpCallback callback;
+	void *userData;
+	struct http_request_s *next;
+} http_request_t;
+
+static void SDL_RWHttpStreamRelease (http_stream_t *stream);
+static void SDL_RWHttpStreamFinish (http_stream_t *stream);
+static SDL_bool SDL_RWHttpStreamResume (http_stream_t *stream);
+
+static CURLM *multiHandle;
+static SDL_Thread *multiThread;
+static SDL_mutex *multiLock;
+static http_request_t *newRequests;     /* queued by SDL_RWFromHttpAsync, guarded by multiLock */
+static http_request_t *newRequestsTail;
+static http_request_t *activeRequests;  /* added to multiHandle, only used by the download thread */
+static SDL_bool multiQuit;              /* guarded by multiLock */
+
+static void SDL_RWHttpFinish (http_request_t *request, CURLcode result)
 {
-	SDL_SetError("Not yet supported");
+	SDL_RWops *rwops = NULL;
+
+	if (request->stream) {
+		if (result != CURLE_OK) {
+			SDL_SetError(curl_easy_strerror(result));
+		}
+		SDL_RWHttpCurlRelease(request->curl);
+		SDL_RWHttpStreamFinish(request->stream);
+		SDL_free(request);
+		return;
+	}
+
+	result = SDL_RWHttpCacheComplete(request->curl, request->httpData, result);
+	if (result == CURLE_OK) {
+		rwops = SDL_RWHttpCreate(request->httpData);
+		if (!rwops) {
+			SDL_SetError("Could not fetch the data from %s", request->httpData->uri);
+		}
+	} else {
+		SDL_SetError(curl_easy_strerror(result));
+	}
+
+	if (!rwops) {
+		SDL_RWHttpCurlRelease(request->curl);
+		SDL_RWHttpClearData(request->httpData);
+		SDL_free(request->httpData);
+	}
+
+	request->callback(rwops, request->userData);
+	SDL_free(request);
+}
+
+/* Drives all asynchronous transfers; completion callbacks run on this thread */
+static int SDL_RWHttpMultiLoop (void *unused)
+{
+	for (;;) {
+		http_request_t *request;
+		CURLMsg *msg;
+		int running;
+		int queued;
+
+		SDL_LockMutex(multiLock);
+		if (multiQuit) {
+			SDL_UnlockMutex(multiLock);
+			break;
+		}
+		request = newRequests;
+		newRequests = newRequestsTail = NULL;
+		SDL_UnlockMutex(multiLock);
+
+		while (request) {
+			http_request_t *next = request->next;
+			curl_multi_add_handle(multiHandle, request->curl);
+			request->next = activeRequests;
+			activeRequests = request;
+			request = next;
+		}
+
+		/* Resumes the streams whose reader made room in their ring buffer */
+		for (request = activeRequests; request; request = request->next) {
+			if (request->stream && SDL_RWHttpStreamResume(request->stream)) {
+				curl_easy_pause(request->curl, CURLPAUSE_CONT);
+			}
+		}
+
+		curl_multi_perform(multiHandle, &running);
+
+		while ((msg = curl_multi_info_read(multiHandle, &queued)) != NULL) {
+			if (msg->msg == CURLMSG_DONE) {
+				CURL *curl = msg->easy_handle;
+				const CURLcode result = msg->data.result;
+				http_request_t **link = &activeRequests;
+				curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&request);
+				curl_multi_remove_handle(multiHandle, curl);
+				while (*link != request) {
+					link = &(*link)->next;
+				}
+				*link = request->next;
+				SDL_RWHttpFinish(request, result);
+			}
+		}
+
+		/* Sleeps until there is socket activity or SDL_RWFromHttpAsync wakes us up */
+		curl_multi_poll(multiHandle, NULL, 0, 1000, NULL);
+	}
+
+	return 0;
+}
+
+static int SDL_RWHttpMultiStart (void)
+{
+	multiHandle = curl_multi_init();
+	multiLock = SDL_CreateMutex();
+	if (multiHandle == NULL || multiLock == NULL) {
+		SDL_SetError("could not set up the asynchronous download queue");
+		return -1;
+	}
+	curl_multi_setopt(multiHandle, CURLMOPT_MAX_HOST_CONNECTIONS, (long)maxHostConnections);
+
+	multiQuit = SDL_FALSE;
+	multiThread = SDL_CreateThread(SDL_RWHttpMultiLoop, "SDL_rwhttp", NULL);
+	if (multiThread == NULL) {
+		/* The sdl error is already set */
+		return -1;
+	}
+	return 0;
+}
+
+/* Frees a list of requests whose transfers never finished, without calling back */
+static void SDL_RWHttpDrop (http_request_t *request, SDL_bool added)
+{
+	while (request) {
+		http_request_t *next = request->next;
+		if (added) {
+			curl_multi_remove_handle(multiHandle, request->curl);
+		}
+		SDL_RWHttpCurlRelease(request->curl);
+		if (request->stream) {
+			SDL_RWHttpStreamFinish(request->stream);
+		} else {
+			SDL_RWHttpClearData(request->httpData);
+			SDL_free(request->httpData);
+		}
+		SDL_free(request);
+		request = next;
+	}
+}
+
+static void SDL_RWHttpMultiStop (void)
+{
+	if (multiThread) {
+		SDL_LockMutex(multiLock);
+		multiQuit = SDL_TRUE;
+		SDL_UnlockMutex(multiLock);
+		curl_multi_wakeup(multiHandle);
+		SDL_WaitThread(multiThread, NULL);
+		multiThread = NULL;
+	}
+
+	/* Transfers still queued or running are dropped; the running ones are
+	   taken off the multi handle before it is cleaned up */
+	SDL_RWHttpDrop(activeRequests, SDL_TRUE);
+	SDL_RWHttpDrop(newRequests, SDL_FALSE);
+	activeRequests = NULL;
+	newRequests = newRequestsTail = NULL;
+
+	if (multiHandle) {
+		curl_multi_cleanup(multiHandle);
+		multiHandle = NULL;
+	}
+	if (multiLock) {
+		SDL_DestroyMutex(multiLock);
+		multiLock = NULL;
+	}
+}
+#endif
+
+#ifdef HAVE_CURL
+/* Hands a request over to the download thread */
+static void SDL_RWHttpQueue (http_request_t *request)
+{
+	curl_easy_setopt(request->curl, CURLOPT_PRIVATE, (void *)request);
+
+	SDL_LockMutex(multiLock);
+	if (newRequestsTail) {
+		newRequestsTail->next = request;
+	} else {
+		newRequests = request;
+	}
+	newRequestsTail = request;
+	SDL_UnlockMutex(multiLock);
+
+	curl_multi_wakeup(multiHandle);
+}
+#endif
+
+int SDL_RWFromHttpAsync (const char *uri, SDL_RWHttpCallback callback, void *userData)
+{
+#ifdef HAVE_CURL
+	http_request_t *request;
+	http_data_t *httpData;
+
+	if (!uri || uri[0] == '\0') {
+		SDL_SetError("No uri given");
+		return -1;
+	}
+	if (!callback) {
+		SDL_SetError("No callback given");
+		return -1;
+	}
+	if (!multiThread) {
+		SDL_SetError("SDL_RWHttpInit was not called");
+		return -1;
+	}
+
+	httpData = (http_data_t*)SDL_malloc(sizeof(*httpData));
+	request = (http_request_t*)SDL_malloc(sizeof(*request));
+	if (httpData == NULL || request == NULL) {
+		SDL_free(httpData);
+		SDL_free(request);
+		SDL_SetError("not enough memory (malloc returned NULL)");
+		return -1;
+	}
+	SDL_zerop(httpData);
+	SDL_zerop(request);
+
+	httpData->uri = SDL_strdup(uri);
+	request->curl = SDL_RWHttpCurlCreate(uri, httpData);
+	if (request->curl == NULL) {
+		SDL_free(httpData->uri);
+		SDL_free(httpData);
+		SDL_free(request);
+		SDL_SetError("could not create curl handle");
+		return -1;
+	}
+	request->httpData = httpData;
+	request->callback = callback;
+	request->userData = userData;
+	SDL_RWHttpCacheRequest(request->curl, httpData);
+
+	SDL_RWHttpQueue(request);
+	return 0;
+#else
+	SDL_SetError("Asynchronous downloads require curl");
+	return -1;
+#endif
+}
+
+#ifdef HAVE_CURL
+/* Room a reader has to make in a full ring buffer before the transfer is resumed, so
+   a slow reader does not resume it for every few bytes */
+#define STREAM_RESUME_ROOM (64 * 1024)
+
+static void SDL_RWHttpStreamRelease (http_stream_t *stream)
+{
+	int refs;
+
+	SDL_LockMutex(stream->lock);
+	refs = --stream->refs;
+	SDL_UnlockMutex(stream->lock);
+
+	if (refs == 0) {
+		SDL_DestroyCond(stream->changed);
+		SDL_DestroyMutex(stream->lock);
+		SDL_RWHttpClearData(&stream->httpData);
+		SDL_free(stream->ring);
+		SDL_free(stream);
+	}
+}
+
+/* Called by the download thread once the transfer of a stream has ended */
+static void SDL_RWHttpStreamFinish (http_stream_t *stream)
+{
+	SDL_LockMutex(stream->lock);
+	stream->done = SDL_TRUE;
+	SDL_CondBroadcast(stream->changed);
+	SDL_UnlockMutex(stream->lock);
+
+	SDL_RWHttpStreamRelease(stream);
+}
+
+/* Called by the download thread; returns whether the paused transfer of a stream is to be resumed */
+static SDL_bool SDL_RWHttpStreamResume (http_stream_t *stream)
+{
+	SDL_bool resume;
+
+	SDL_LockMutex(stream->lock);
+	resume = stream->resume;
+	if (resume) {
+		stream->paused = SDL_FALSE;
+		stream->resume = SDL_FALSE;
+	}
+	SDL_UnlockMutex(stream->lock);
+	return resume;
+}
+
+/* Asks the download thread to resume a paused transfer once the reader made room for
+   it, or closed the stream so the transfer can be aborted; called with the lock held */
+static void http_stream_make_room (http_stream_t *stream)
+{
+	if (stream->paused && !stream->resume &&
+		(stream->closed || stream->position + stream->capacity - stream->end >= STREAM_RESUME_ROOM)) {
+		stream->resume = SDL_TRUE;
+		if (multiHandle) {
+			curl_multi_wakeup(multiHandle);
+		}
+	}
+}
+
+static size_t SDL_RWHttpStreamHeader (void *headerData, size_t size, size_t nmemb, void *userData)
+{
+	http_stream_t *stream = (http_stream_t *) userData;
+	size_t result;
+
+	SDL_LockMutex(stream->lock);
+	result = SDL_RWHttpHeader(headerData, size, nmemb, &stream->httpData);
+	SDL_UnlockMutex(stream->lock);
+	return result;
+}
+
+static size_t SDL_RWHttpStreamWrite (void *streamData, size_t size, size_t nmemb, void *userData)
+{
+	http_stream_t *stream = (http_stream_t *) userData;
+	const size_t realsize = size * nmemb;
+	size_t result = realsize;
+
+	SDL_LockMutex(stream->lock);
+	if (stream->closed) {
+		result = 0;
+	} else if (stream->end + realsize > stream->position + stream->capacity) {
+		/* The ring is full of unread data: curl delivers the same data again once resumed */
+		stream->paused = SDL_TRUE;
+		result = CURL_WRITEFUNC_PAUSE;
+	} else {
+		const size_t offset = stream->end % stream->capacity;
+		const size_t first = SDL_min(realsize, stream->capacity - offset);
+		SDL_memcpy(stream->ring + offset, streamData, first);
+		SDL_memcpy(stream->ring, (const Uint8 *)streamData + first, realsize - first);
+		stream->end += realsize;
+		if (stream->end - stream->start > stream->capacity) {
+			stream->start = stream->end - stream->capacity;
+		}
+		SDL_CondBroadcast(stream->changed);
+	}
+	SDL_UnlockMutex(stream->lock);
+	return result;
+}
+
+/* Waits until the download reached the given offset or ended; called with the lock held */
+static void http_stream_wait (http_stream_t *stream, size_t offset)
+{
+	while (!stream->done && stream->end < offset) {
+		http_stream_make_room(stream);
+		SDL_CondWait(stream->changed, stream->lock);
+	}
+}
+
+static int http_stream_close (SDL_RWops * context)
+{
+	if (!context) {
+		return 0;
+	}
+
+	if (context->hidden.unknown.data1) {
+		http_stream_t *stream = (http_stream_t*) context->hidden.unknown.data1;
+		SDL_LockMutex(stream->lock);
+		stream->closed = SDL_TRUE;
+		http_stream_make_room(stream);
+		SDL_UnlockMutex(stream->lock);
+		SDL_RWHttpStreamRelease(stream);
+	}
+	SDL_FreeRW(context);
+	return 0;
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+/* The announced length, or the bytes received once the download ended; -1 until either is known */
+static Sint64 http_stream_size (SDL_RWops * context)
+{
+	http_stream_t *stream = (http_stream_t*) context->hidden.unknown.data1;
+	Sint64 size;
+
+	SDL_LockMutex(stream->lock);
+	if (stream->done) {
+		size = (Sint64)stream->end;
+	} else if (stream->httpData.expectedSize > 0) {
+		size = (Sint64)stream->httpData.expectedSize;
+	} else {
+		size = -1;
+	}
+	SDL_UnlockMutex(stream->lock);
+	return size;
+}
+#endif
+
+static SEEK_INT http_stream_seek (SDL_RWops * context, SEEK_INT offset, int whence)
+{
+	http_stream_t *stream = (http_stream_t*) context->hidden.unknown.data1;
+	Sint64 newpos;
+
+	SDL_LockMutex(stream->lock);
+	switch (whence) {
+	case RW_SEEK_SET:
+		newpos = offset;
+		break;
+	case RW_SEEK_CUR:
+		newpos = (Sint64)stream->position + offset;
+		break;
+	case RW_SEEK_END:
+		if (!stream->done && stream->httpData.expectedSize == 0) {
+			SDL_UnlockMutex(stream->lock);
+			SDL_SetError("The length of the stream is not known yet");
+			return -1;
+		}
+		newpos = (Sint64)(stream->done ? stream->end : stream->httpData.expectedSize) + offset;
+		break;
+	default:
+		SDL_UnlockMutex(stream->lock);
+		SDL_SetError("Unknown value for 'whence'");
+		return -1;
+	}
+	if (newpos < 0) {
+		newpos = 0;
+	}
+	if (stream->done && (size_t)newpos > stream->end) {
+		newpos = stream->end;
+	}
+
+	/* Only the part of the stream the ring can hold from its oldest byte on can be reached */
+	if ((size_t)newpos < stream->start || (size_t)newpos > stream->start + stream->capacity) {
+		SDL_UnlockMutex(stream->lock);
+		SDL_SetError("Can't seek outside the buffered part of the stream");
+		return -1;
+	}
+	stream->position = (size_t)newpos;
+	if (stream->blocking) {
+		http_stream_wait(stream, stream->position);
+	}
+	http_stream_make_room(stream);
+	SDL_UnlockMutex(stream->lock);
+	return (SEEK_INT)newpos;
+}
+
+/* A blocking stream waits until all the requested data has arrived; otherwise only
+   what is buffered is returned, and a decoder that reads faster than the download
+   runs dry instead of holding up the thread it is decoding on */
+static READ_INT http_stream_read (SDL_RWops * context, void *ptr, READ_INT size, READ_INT maxnum)
+{
+	http_stream_t *stream = (http_stream_t*) context->hidden.unknown.data1;
+	Uint8 *bytes = (Uint8 *)ptr;
+	READ_INT total_bytes;
+	READ_INT copied = 0;
+
+	total_bytes = (maxnum * size);
+	if (maxnum <= 0 || size <= 0 || total_bytes / maxnum != size) {
+		return 0;
+	}
+
+	SDL_LockMutex(stream->lock);
+	for (;;) {
+		size_t available = stream->end > stream->position ? stream->end - stream->position : 0;
+		size_t length = SDL_min(available, total_bytes - copied);
+		if (!stream->blocking && !stream->done) {
+			/* Leave a partial object for the next read */
+			length -= (copied + length) % size;
+		}
+		while (length > 0) {
+			const size_t offset = stream->position % stream->capacity;
+			const size_t piece = SDL_min(length, stream->capacity - offset);
+			SDL_memcpy(bytes + copied, stream->ring + offset, piece);
+			stream->position += piece;
+			copied += piece;
+			length -= piece;
+		}
+		if (copied == total_bytes || stream->done || !stream->blocking) {
+			break;
+		}
+		http_stream_wait(stream, stream->position + 1);
+	}
+	http_stream_make_room(stream);
+	SDL_UnlockMutex(stream->lock);
+
+	return copied / size;
+}
+#endif
+
+SDL_RWops* SDL_RWFromHttpStream (const char *uri, size_t preroll)
+{
+#ifdef HAVE_CURL
+	http_request_t *request;
+	http_stream_t *stream;
+	SDL_RWops *rwops;
+
+	if (!uri || uri[0] == '\0') {
+		SDL_SetError("No uri given");
+		return NULL;
+	}
+	if (!multiThread) {
+		SDL_SetError("SDL_RWHttpInit was not called");
+		return NULL;
+	}
+
+	stream = (http_stream_t*)SDL_malloc(sizeof(*stream));
+	request = (http_request_t*)SDL_malloc(sizeof(*request));
+	rwops = SDL_AllocRW();
+	if (stream == NULL || request == NULL || rwops == NULL) {
+		SDL_free(stream);
+		SDL_free(request);
+		if (rwops) {
+			SDL_FreeRW(rwops);
+		}
+		SDL_SetError("not enough memory (malloc returned NULL)");
+		return NULL;
+	}
+	SDL_zerop(stream);
+	SDL_zerop(request);
+
+	stream->lock = SDL_CreateMutex();
+	stream->changed = SDL_CreateCond();
+	stream->ring = (Uint8*)SDL_malloc(streamBuffer);
+	stream->capacity = streamBuffer;
+	stream->blocking = SDL_TRUE;
+	stream->httpData.uri = SDL_strdup(uri);
+	stream->httpData.streamed = SDL_TRUE;
+	stream->refs = 2;
+	request->stream = stream;
+	request->curl = SDL_RWHttpCurlCreate(uri, &stream->httpData);
+	if (request->curl == NULL || stream->lock == NULL || stream->changed == NULL || stream->ring == NULL) {
+		SDL_RWHttpCurlRelease(request->curl);
+		stream->refs = 1;
+		SDL_RWHttpStreamRelease(stream);
+		SDL_free(request);
+		SDL_FreeRW(rwops);
+		SDL_SetError("could not set up the stream for %s", uri);
+		return NULL;
+	}
+
+	/* A long stream may take longer than the transfer timeout, so only abort stalled transfers;
+	   curl does not count the time a transfer is paused for a full ring buffer */
+	curl_easy_setopt(request->curl, CURLOPT_WRITEFUNCTION, SDL_RWHttpStreamWrite);
+	curl_easy_setopt(request->curl, CURLOPT_HEADERFUNCTION, SDL_RWHttpStreamHeader);
+	curl_easy_setopt(request->curl, CURLOPT_WRITEDATA, (void * )stream);
+	curl_easy_setopt(request->curl, CURLOPT_HEADERDATA, (void * )stream);
+	curl_easy_setopt(request->curl, CURLOPT_TIMEOUT, 0L);
+	curl_easy_setopt(request->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt(request->curl, CURLOPT_LOW_SPEED_TIME, (long)timeout);
+
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	rwops->size = http_stream_size;
+#endif
+	rwops->seek = http_stream_seek;
+	rwops->read = http_stream_read;
+	rwops->write = http_writeconst;
+	rwops->close = http_stream_close;
+	rwops->hidden.unknown.data1 = stream;
+	rwops->type = SDL_RWOPS_HTTP;
+
+	SDL_RWHttpQueue(request);
+
+	/* Wait for the pre-roll, so the decoder does not immediately starve */
+	SDL_LockMutex(stream->lock);
+	http_stream_wait(stream, SDL_min(preroll, stream->capacity));
+	if (stream->done && stream->end == 0) {
+		SDL_UnlockMutex(stream->lock);
+		SDL_SetError("Could not fetch the data from %s", uri);
+		http_stream_close(rwops);
+		return NULL;
+	}
+	SDL_UnlockMutex(stream->lock);
+	return rwops;
+#else
+	SDL_SetError("Streamed downloads require curl");
 	return NULL;
-}
\ No newline at end of file
+#endif
+}
+
+int SDL_RWHttpStreamSetBlocking (SDL_RWops *rwops, SDL_bool blocking)
+{
+#ifdef HAVE_CURL
+	http_stream_t *stream;
+
+	if (!rwops || rwops->type != SDL_RWOPS_HTTP || rwops->close != http_stream_close) {
+		SDL_SetError("Not a http stream");
+		return -1;
+	}
+
+	stream = (http_stream_t*) rwops->hidden.unknown.data1;
+	SDL_LockMutex(stream->lock);
+	stream->blocking = blocking;
+	SDL_UnlockMutex(stream->lock);
+	return 0;
+#else
+	SDL_SetError("Streamed downloads require curl");
+	return -1;
+#endif
+}
@@ -53,6 +53,40 @@ extern "C" {
  */
 #define SDL_RWHTTP_HINT_FETCHLIMIT "SDL_RWHTTP_FETCHLIMIT"
 
+/**
+ * \brief Defines the max. number of connections kept open to a single host
+ * by asynchronous downloads. Idle connections are reused by later requests.
+ *
+ * \note The value can not be changed after \c SDL_RWHttpInit was called.
+ */
+#define SDL_RWHTTP_HINT_MAXHOSTCONNECTIONS "SDL_RWHTTP_MAXHOSTCONNECTIONS"
+
+/**
+ * \brief Defines the size in bytes of the ring buffer a stream keeps of its
+ * download (default 4 MB, at least 256 KB).
+ *
+ * \note The value can not be changed after \c SDL_RWHttpInit was called.
+ */
+#define SDL_RWHTTP_HINT_STREAMBUFFER "SDL_RWHTTP_STREAMBUFFER"
+
+/**
+ * \brief A directory that keeps downloaded files across restarts. Cached
+ * files are revalidated with conditional requests and reused when the
+ * server answers 304 Not Modified or cannot be reached. Unset disables
+ * the cache.
+ *
+ * \note The value can not be changed after \c SDL_RWHttpInit was called.
+ */
+#define SDL_RWHTTP_HINT_CACHEDIR "SDL_RWHTTP_CACHEDIR"
+
+/**
+ * \brief Defines the max. size of the cache directory in megabytes (default
+ * 512). The least recently used files are deleted when it is exceeded.
+ *
+ * \note The value can not be changed after \c SDL_RWHttpInit was called.
+ */
+#define SDL_RWHTTP_HINT_CACHESIZE "SDL_RWHTTP_CACHESIZE"
+
 /**
  * \brief Initializes the library. Should only be called once per application.
  * Also initializes and caches the hint values.
@@ -68,14 +102,55 @@ extern DECLSPEC int SDL_RWHttpInit (void);
  */
 extern DECLSPEC int SDL_RWHttpShutdown (void);
 
+/**
+ * \brief Called once an asynchronous download has finished.
+ *
+ * \param rwops The downloaded data, or \c NULL if the download failed (see
+ * \c SDL_GetError). The callback takes ownership and must close it.
+ * \param userData The pointer that was given to \c SDL_RWFromHttpAsync.
+ *
+ * \note Runs on the download thread and delays all other transfers while it
+ * runs, so it should only hand the data over to another thread.
+ */
+typedef void (SDLCALL *SDL_RWHttpCallback) (SDL_RWops *rwops, void *userData);
+
 /**
  * \name RWFrom functions
  *
  * Functions to create SDL_RWops structures from http streams.
+ *
+ * \c SDL_RWFromHttpAsync queues the download on a single background thread
+ * that runs all queued transfers concurrently, and returns -1 if the
+ * download could not be queued, 0 otherwise.
  */
-extern DECLSPEC SDL_RWops* SDL_RWFromHttpAsync (const char *uri);
+extern DECLSPEC int SDL_RWFromHttpAsync (const char *uri, SDL_RWHttpCallback callback, void *userData);
 extern DECLSPEC SDL_RWops* SDL_RWFromHttpSync (const char *uri);
 
+/**
+ * \brief Starts a download and returns a read-only stream over it once
+ * \c preroll bytes have arrived (or the download ended), so decoding can
+ * begin while the rest is still downloading.
+ *
+ * Only the last \c SDL_RWHTTP_HINT_STREAMBUFFER bytes of the download are
+ * kept, so the length of a stream is not limited by the fetch limit; the
+ * download is paused while the buffer is full of data not read yet.
+ *
+ * \note A new stream is blocking: reads and seeks past the downloaded data
+ * wait until it arrives. Seeks before the oldest buffered byte or further
+ * ahead than the buffer holds fail, and so do seeks relative to the end
+ * until the length is known.
+ */
+extern DECLSPEC SDL_RWops* SDL_RWFromHttpStream (const char *uri, size_t preroll);
+
+/**
+ * \brief Switches a stream between reads that wait for the data to arrive
+ * and reads that only return what is buffered, e.g. once the stream is read
+ * on a thread that must not block.
+ *
+ * \return -1 if \c rwops is not a stream, 0 otherwise.
+ */
+extern DECLSPEC int SDL_RWHttpStreamSetBlocking (SDL_RWops *rwops, SDL_bool blocking);
+
 /* Ends C function definitions when using C++ */
 #ifdef __cplusplus
 }
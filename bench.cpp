@@ -0,0 +1,1160 @@
+#include <argp.h>                    // For argument parsing
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SDL.h"
+#include "SDL_mixer.h"
+
+#include "command.h"
+#include "mixkernel.h"
+#include "mqttaudio.h"
+#include "resampler.h"
+#include "voicemixer.h"
+#include "SDL_rwhttp.h"
+
+// Replays commands through the player's real command path, from message_callback
+// through the executor and the sample loaders to the mixer, on SDL's dummy audio
+// driver and without a broker, and reports throughput and per-stage latencies.
+
+const char *argp_program_version = "0.1.2";
+const char *argp_program_bug_address = "contact@mindgeist.com";
+
+static const char *stageNames[STAGE_COUNT] =
+{
+    "queue",
+    "parse",
+    "dispatch",
+    "cache lookup",
+    "load",
+    "play call",
+};
+
+std::string logFile = "";                      // JSONL command log to replay
+int synthetic = 0;                             // Number of generated commands, if no log is given
+bool binary = false;                           // Replay commands in the binary encoding
+bool dispatchOnly = false;                     // Only run the dispatch microbenchmark
+bool mixingOnly = false;                       // Only run the mixing benchmark
+bool resamplingOnly = false;                   // Only run the resampling benchmark
+bool httpOnly = false;                         // Only run the HTTP benchmark
+bool allocationsOnly = false;                  // Only run the command path allocation check
+int loadThreads = 2;                           // Number of background sample loader threads
+
+SDL_mutex *stageLock = NULL;                   // Guards stageTimes, recorded from several threads
+std::vector<Uint64> stageTimes[STAGE_COUNT];   // Durations per stage in performance counter ticks
+
+void recordStage(Stage stage, Uint64 elapsed)
+{
+    SDL_LockMutex(stageLock);
+    stageTimes[stage].push_back(elapsed);
+    SDL_UnlockMutex(stageLock);
+}
+
+size_t recordedCount(Stage stage)
+{
+    SDL_LockMutex(stageLock);
+    size_t count = stageTimes[stage].size();
+    SDL_UnlockMutex(stageLock);
+    return count;
+}
+
+// Every heap allocation of the process goes through malloc, operator new included, so
+// wrapping glibc's allocator counts them all while countAllocations is set
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+
+volatile bool countAllocations = false;        // Whether allocations are being counted
+std::atomic<long> allocations(0);              // Allocations counted so far
+
+extern "C" void *malloc(size_t size)
+{
+    if (countAllocations)
+    {
+        allocations++;
+    }
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    if (countAllocations)
+    {
+        allocations++;
+    }
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    if (countAllocations)
+    {
+        allocations++;
+    }
+    return __libc_realloc(pointer, size);
+}
+
+// Writes a short stereo sine wave as a 16 bit WAV file
+bool writeTestWave(const std::string &path, int frequency, float seconds, float pitch)
+{
+    int frames = (int)(frequency * seconds);
+    Uint32 dataLength = frames * 4;
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    struct
+    {
+        char riff[4]; Uint32 riffLength; char wave[4];
+        char fmt[4]; Uint32 fmtLength; Uint16 format; Uint16 channels; Uint32 rate; Uint32 byteRate; Uint16 blockAlign; Uint16 bits;
+        char data[4]; Uint32 dataLength;
+    } header = { {'R', 'I', 'F', 'F'}, 36 + dataLength, {'W', 'A', 'V', 'E'},
+                 {'f', 'm', 't', ' '}, 16, 1, 2, (Uint32)frequency, (Uint32)frequency * 4, 4, 16,
+                 {'d', 'a', 't', 'a'}, dataLength };
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (int i = 0; i < frames; i++)
+    {
+        Sint16 value = (Sint16)(8000 * sin(2 * M_PI * pitch * i / frequency));
+        Sint16 frame[2] = { value, value };
+        fwrite(frame, sizeof(frame), 1, file);
+    }
+
+    fclose(file);
+    return true;
+}
+
+std::string sampleDirectory = "";              // Directory of the generated test samples, removed on exit
+std::vector<std::string> samples;              // Generated test samples
+
+// Removes the generated test samples and their directory
+void removeTestSamples(void)
+{
+    for (auto &sample : samples)
+    {
+        unlink(sample.c_str());
+    }
+    if (!sampleDirectory.empty())
+    {
+        rmdir(sampleDirectory.c_str());
+    }
+}
+
+// Writes a few short test samples of different pitches to a temporary directory
+bool writeTestSamples(int count)
+{
+    char directory[] = "/tmp/mqttaudio-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL)
+    {
+        fprintf(stderr, "Unable to create a directory for the test samples.\n");
+        return false;
+    }
+    sampleDirectory = directory;
+    atexit(removeTestSamples);
+
+    for (int i = 0; i < count; i++)
+    {
+        samples.push_back(std::string(directory) + "/sample" + std::to_string(i) + ".wav");
+        if (!writeTestWave(samples.back(), 44100, 0.25f, 220.0f * (i + 1)))
+        {
+            fprintf(stderr, "Unable to write test sample '%s'.\n", samples.back().c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Generates a mix of plays, volume changes and fades over a few test samples
+bool generateCommands(int count, std::vector<std::string> &payloads)
+{
+    const int sampleCount = 8;
+    if (!writeTestSamples(sampleCount))
+    {
+        return false;
+    }
+
+    char payload[512];
+    for (int i = 0; i < count; i++)
+    {
+        int channel = i % 16;
+        switch (i % 10)
+        {
+        case 0: case 1: case 2: case 3: case 4: case 5:
+            snprintf(payload, sizeof(payload), "{\"command\":\"play\",\"message\":{\"file\":\"%s\",\"channel\":%d,\"volume\":0.8}}",
+                     samples[i % sampleCount].c_str(), channel);
+            break;
+        case 6: case 7: case 8:
+            snprintf(payload, sizeof(payload), "{\"command\":\"soundSetVolume\",\"message\":{\"channel\":%d,\"volume\":%.2f}}",
+                     channel, (i % 100) / 100.0f);
+            break;
+        default:
+            snprintf(payload, sizeof(payload), "{\"command\":\"fadeout\",\"message\":{\"channel\":%d,\"time\":50}}", channel);
+            break;
+        }
+        payloads.push_back(payload);
+    }
+    return true;
+}
+
+bool readCommands(const std::string &path, std::vector<std::string> &payloads)
+{
+    std::ifstream stream(path);
+    if (!stream)
+    {
+        fprintf(stderr, "Unable to open command log '%s'.\n", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (!line.empty())
+        {
+            payloads.push_back(line);
+        }
+    }
+    return true;
+}
+
+// Re-encodes the commands that the binary encoding can carry
+void encodeBinary(std::vector<std::string> &payloads)
+{
+    CommandDecoder decoder;
+    int encoded = 0;
+    for (auto &payload : payloads)
+    {
+        std::vector<char> insitu(payload.c_str(), payload.c_str() + payload.size() + 1);
+        Command command;
+        std::string binaryPayload;
+        if (decoder.Decode(insitu.data(), payload.size(), command) && EncodeBinaryCommand(command, binaryPayload))
+        {
+            payload = binaryPayload;
+            encoded++;
+        }
+    }
+    printf("Encoded %d of %d commands in the binary encoding.\n", encoded, (int)payloads.size());
+}
+
+// Decodes typical payloads over and over with the decoder the executor uses and fails
+// if decoding any of them still allocates once the decoder has warmed up
+bool checkDecoderAllocations(void)
+{
+    const int warmup = 100;
+    const int iterations = 100000;
+    const char *payloads[][2] =
+    {
+        {"play", "{\"command\":\"play\",\"message\":{\"file\":\"http://sounds.local/door.wav\",\"channel\":3,\"volume\":0.8,"
+                 "\"loop\":true,\"pan\":-0.5,\"priority\":2,\"id\":17,\"fadeIn\":200,\"curve\":\"exp\",\"bus\":\"sfx\",\"delay\":25}}"},
+        {"soundSetVolume", "{\"command\":\"soundSetVolume\",\"message\":{\"channel\":3,\"volume\":0.25,\"time\":500}}"},
+        {"fadeout", "{\"command\":\"fadeout\",\"message\":{\"channel\":3,\"time\":50}}"},
+        {"stopall", "{\"command\":\"stopall\",\"message\":{\"keepBgm\":true}}"},
+        {"batch", "{\"command\":\"batch\",\"message\":{\"at\":1760000000000,\"commands\":["
+                  "{\"command\":\"play\",\"message\":{\"file\":\"a.wav\",\"channel\":1}},"
+                  "{\"command\":\"play\",\"message\":{\"file\":\"b.wav\",\"channel\":2,\"volume\":0.5}},"
+                  "{\"command\":\"fadeout\",\"message\":{\"channel\":0,\"time\":100}}]}}"},
+    };
+
+    CommandDecoder decoder;
+    std::vector<std::pair<std::string, std::string> > cases;
+    for (auto &payload : payloads)
+    {
+        cases.push_back(std::make_pair(std::string(payload[0]), std::string(payload[1])));
+    }
+
+    // The play command in the binary encoding too
+    std::vector<char> insitu(cases[0].second.c_str(), cases[0].second.c_str() + cases[0].second.size() + 1);
+    Command command;
+    std::string binaryPayload;
+    if (!decoder.Decode(insitu.data(), cases[0].second.size(), command))
+    {
+        return false;
+    }
+    command.fields &= ~(FIELD_PAN | FIELD_PRIORITY | FIELD_ID | FIELD_CURVE | FIELD_FADE_IN | FIELD_BUS | FIELD_DELAY);
+    if (!EncodeBinaryCommand(command, binaryPayload))
+    {
+        fprintf(stderr, "Unable to encode the play command in the binary encoding.\n");
+        return false;
+    }
+    cases.push_back(std::make_pair(std::string("play (binary)"), binaryPayload));
+
+    size_t longest = 0;
+    for (auto &test : cases)
+    {
+        longest = std::max(longest, test.second.size());
+    }
+    std::vector<char> buffer(longest + 1);
+
+    bool passed = true;
+    printf("%-16s %12s %14s\n", "command", "decodes", "allocations");
+    for (auto &test : cases)
+    {
+        const std::string &payload = test.second;
+        long counted = 0;
+        for (int n = 0; n < warmup + iterations; n++)
+        {
+            memcpy(buffer.data(), payload.data(), payload.size());
+            buffer[payload.size()] = '\0';
+
+            long before = allocations;
+            countAllocations = n >= warmup;
+            bool decoded = decoder.Decode(buffer.data(), payload.size(), command);
+            countAllocations = false;
+            counted += allocations - before;
+
+            if (!decoded)
+            {
+                fprintf(stderr, "Unable to decode the %s command.\n", test.first.c_str());
+                return false;
+            }
+        }
+
+        printf("%-16s %12d %14ld\n", test.first.c_str(), iterations, counted);
+        passed = passed && counted == 0;
+    }
+
+    if (!passed)
+    {
+        fprintf(stderr, "Decoding commands allocates after warming up.\n");
+    }
+    return passed;
+}
+
+std::atomic<int> loadsFinished(0);             // Samples loaded while checking the command path
+
+// Stage recorder of the command path check: counting stops once the executor has
+// dispatched a command, before its handler runs
+void countUntilDispatch(Stage stage, Uint64 elapsed)
+{
+    if (stage == STAGE_DISPATCH)
+    {
+        countAllocations = false;
+    }
+    else if (stage == STAGE_LOAD)
+    {
+        loadsFinished++;
+    }
+}
+
+// Hands a payload to message_callback, as the broker client would, and waits until the
+// executor has carried it out
+void replayMessage(const std::string &payload, char *topicName)
+{
+    struct mosquitto_message message;
+    memset(&message, 0, sizeof(message));
+    message.topic = topicName;
+    message.payload = (void *)payload.data();
+    message.payloadlen = payload.size();
+    message_callback(NULL, NULL, &message);
+    while (!commandQueueEmpty())
+    {
+        SDL_Delay(0);
+    }
+}
+
+// Replays typical commands through the player's command path, from message_callback
+// through the queue to the executor's copy, decode and dispatch, and fails if that still
+// allocates once warmed up. Counting stops when a command has been dispatched, so the
+// handlers, which start voices, are left out; every other thread counts too, so the
+// samples are loaded before counting starts.
+bool checkCommandPathAllocations(void)
+{
+    const int sampleCount = 4;
+    const int warmup = 256;                    // Rounds of every command, one per slot of the command queue
+    const int rounds = 3000;
+    if (!writeTestSamples(sampleCount))
+    {
+        return false;
+    }
+
+    char payload[1024];
+    std::vector<std::pair<std::string, std::string> > cases;
+    snprintf(payload, sizeof(payload), "{\"command\":\"play\",\"message\":{\"file\":\"%s\",\"channel\":3,\"volume\":0.8,\"loop\":true,"
+             "\"pan\":-0.5,\"priority\":2,\"id\":17,\"fadeIn\":200,\"curve\":\"exponential\",\"bus\":\"sfx\"}}", samples[0].c_str());
+    cases.push_back(std::make_pair(std::string("play"), std::string(payload)));
+    cases.push_back(std::make_pair(std::string("soundSetVolume"), std::string("{\"command\":\"soundSetVolume\",\"message\":{\"channel\":3,\"volume\":0.25,\"time\":500}}")));
+    cases.push_back(std::make_pair(std::string("busSetVolume"), std::string("{\"command\":\"busSetVolume\",\"message\":{\"bus\":\"sfx\",\"volume\":0.5,\"time\":100}}")));
+    cases.push_back(std::make_pair(std::string("fadeout"), std::string("{\"command\":\"fadeout\",\"message\":{\"channel\":4,\"time\":50}}")));
+    cases.push_back(std::make_pair(std::string("stopall"), std::string("{\"command\":\"stopall\",\"message\":{\"keepBgm\":true}}")));
+    snprintf(payload, sizeof(payload), "{\"command\":\"batch\",\"message\":{\"commands\":["
+             "{\"command\":\"play\",\"message\":{\"file\":\"%s\",\"channel\":1}},"
+             "{\"command\":\"play\",\"message\":{\"file\":\"%s\",\"channel\":2,\"volume\":0.5}},"
+             "{\"command\":\"fadeout\",\"message\":{\"channel\":0,\"time\":100}}]}}", samples[1].c_str(), samples[2].c_str());
+    cases.push_back(std::make_pair(std::string("batch"), std::string(payload)));
+
+    // A play in the binary encoding too
+    snprintf(payload, sizeof(payload), "{\"command\":\"play\",\"message\":{\"file\":\"%s\",\"channel\":5,\"volume\":0.8,\"loop\":true}}", samples[3].c_str());
+    CommandDecoder decoder;
+    Command command;
+    std::string binaryPayload;
+    if (!decoder.Decode(payload, strlen(payload), command) || !EncodeBinaryCommand(command, binaryPayload))
+    {
+        fprintf(stderr, "Unable to encode the play command in the binary encoding.\n");
+        return false;
+    }
+    cases.push_back(std::make_pair(std::string("play (binary)"), binaryPayload));
+
+    // Mix in real time on a device that discards the output
+    setenv("SDL_AUDIODRIVER", "dummy", true);
+    if (!initSDLAudio())
+    {
+        return false;
+    }
+    stageRecorder = countUntilDispatch;
+    manager.SetLoadedCallback(sampleLoaded, NULL);
+    if (!manager.StartLoaders(1) || !startExecutor())
+    {
+        return false;
+    }
+
+    topic = "bench";
+    std::vector<char> topicName(topic.c_str(), topic.c_str() + topic.size() + 1);
+
+    // Load the samples first; the loader threads allocate while decoding them
+    for (auto &sample : samples)
+    {
+        replayMessage("{\"command\":\"precache\",\"message\":{\"file\":\"" + sample + "\"}}", topicName.data());
+    }
+    Uint32 deadline = SDL_GetTicks() + 10000;
+    while (loadsFinished < sampleCount && (Sint32)(SDL_GetTicks() - deadline) < 0)
+    {
+        SDL_Delay(1);
+    }
+
+    bool passed = loadsFinished == sampleCount;
+    if (!passed)
+    {
+        fprintf(stderr, "Unable to load the test samples.\n");
+    }
+
+    // Every round goes through the commands in turn, so over the warmup every slot of the
+    // command queue has held every payload and kept the room it needs
+    std::vector<long> counted(cases.size());
+    for (int n = 0; passed && n < warmup + rounds; n++)
+    {
+        for (size_t i = 0; i < cases.size(); i++)
+        {
+            long before = allocations;
+            countAllocations = n >= warmup;
+            replayMessage(cases[i].second, topicName.data());
+            countAllocations = false;
+            counted[i] += allocations - before;
+        }
+    }
+
+    stageRecorder = NULL;
+    stopExecutor();
+    haltVoice(-1);
+    manager.StopLoaders();
+    manager.FreeAll();
+    Mix_CloseAudio();
+    SDL_RWHttpShutdown();
+    SDL_Quit();
+    if (!passed)
+    {
+        return false;
+    }
+
+    printf("%-16s %12s %14s\n", "command", "replays", "allocations");
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        printf("%-16s %12d %14ld\n", cases[i].first.c_str(), rounds, counted[i]);
+        passed = passed && counted[i] == 0;
+    }
+
+    if (!passed)
+    {
+        fprintf(stderr, "The command path allocates after warming up.\n");
+    }
+    return passed;
+}
+
+// Checks the decoder on its own, then the whole command path up to the handlers
+bool checkAllocations(void)
+{
+    bool decoder = checkDecoderAllocations();
+    printf("\n");
+    return checkCommandPathAllocations() && decoder;
+}
+
+double ticksToMicroseconds(Uint64 ticks)
+{
+    return ticks * 1000000.0 / SDL_GetPerformanceFrequency();
+}
+
+void reportStages(void)
+{
+    printf("%-14s %10s %12s %12s %12s %12s\n", "stage", "count", "p50 us", "p99 us", "p999 us", "max us");
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        std::vector<Uint64> &times = stageTimes[stage];
+        if (times.empty())
+        {
+            printf("%-14s %10d\n", stageNames[stage], 0);
+            continue;
+        }
+
+        std::sort(times.begin(), times.end());
+        auto percentile = [&times](double p) { return ticksToMicroseconds(times[std::min(times.size() - 1, (size_t)(p * times.size()))]); };
+        printf("%-14s %10d %12.2f %12.2f %12.2f %12.2f\n", stageNames[stage], (int)times.size(),
+               percentile(0.5), percentile(0.99), percentile(0.999), ticksToMicroseconds(times.back()));
+    }
+}
+
+// Times the command lookup of every command name, against a linear case-insensitive scan
+void benchmarkDispatch(void)
+{
+    const int iterations = 1000000;
+    size_t count;
+    const CommandSpec *specs = commandTable(&count);
+
+    printf("%-18s %14s %14s\n", "command", "dispatch ns", "linear ns");
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *name = specs[i].name;
+        volatile const CommandSpec *sink = NULL;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int n = 0; n < iterations; n++)
+        {
+            sink = findCommand(name);
+        }
+        Uint64 dispatch = SDL_GetPerformanceCounter() - start;
+
+        start = SDL_GetPerformanceCounter();
+        for (int n = 0; n < iterations; n++)
+        {
+            for (size_t j = 0; j < count; j++)
+            {
+                if (strcasecmp(specs[j].name, name) == 0)
+                {
+                    sink = &specs[j];
+                    break;
+                }
+            }
+        }
+        Uint64 linear = SDL_GetPerformanceCounter() - start;
+        (void)sink;
+
+        printf("%-18s %14.2f %14.2f\n", name, ticksToMicroseconds(dispatch) * 1000 / iterations, ticksToMicroseconds(linear) * 1000 / iterations);
+    }
+}
+
+// Mixes one period of a number of looping voices; SDL_mixer's own channels mix each
+// voice with SDL_MixAudioFormat(), which is what the 'sdl' row measures
+struct MixingRun
+{
+    const char *name;
+    VoiceMixer *mixer;                         // NULL for SDL_MixAudioFormat()
+};
+
+void benchmarkMixing(void)
+{
+    const int voices = 128;
+    const int period = 512;
+    const int frequencies[] = { 44100, 48000 };
+
+    printf("%-8s %-8s %6s %8s %18s %16s\n", "mixer", "kernels", "kHz", "voices", "ns/voice/period", "voices per core");
+    for (int frequency : frequencies)
+    {
+        // One second of noise, which every voice plays from its own offset
+        std::vector<Sint16> source(2 * frequency);
+        Uint32 seed = 1;
+        for (auto &value : source)
+        {
+            seed = seed * 1664525 + 1013904223;
+            value = (Sint16)(seed >> 16) / 4;
+        }
+        std::vector<Sint16> output(2 * period);
+        int periods = 2 * frequency / period;
+
+        std::vector<MixingRun> runs;
+        runs.push_back({ "sdl", NULL });
+        for (const MixKernels *kernels : SupportedMixKernels())
+        {
+            runs.push_back({ "simd", new VoiceMixer(voices, frequency, VoiceMixer::ACCUMULATE_FLOAT, *kernels) });
+            runs.push_back({ "simd16", new VoiceMixer(voices, frequency, VoiceMixer::ACCUMULATE_INT16, *kernels) });
+        }
+
+        for (auto &run : runs)
+        {
+            if (run.mixer != NULL)
+            {
+                for (int voice = 0; voice < voices; voice++)
+                {
+                    int offset = voice * 997 % frequency;
+                    run.mixer->Play(voice, source.data() + 2 * offset, frequency - offset, -1, -1, 0);
+                    run.mixer->SetVolume(voice, 0.75f);
+                }
+            }
+
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int n = 0; n < periods; n++)
+            {
+                memset(output.data(), 0, output.size() * sizeof(Sint16));
+                if (run.mixer != NULL)
+                {
+                    run.mixer->Mix(output.data(), period);
+                    continue;
+                }
+                for (int voice = 0; voice < voices; voice++)
+                {
+                    int position = (voice * 997 + n * period) % (frequency - period);
+                    SDL_MixAudioFormat((Uint8 *)output.data(), (const Uint8 *)(source.data() + 2 * position), AUDIO_S16SYS,
+                                       period * 4, MIX_MAX_VOLUME * 3 / 4);
+                }
+            }
+            double perVoice = ticksToMicroseconds(SDL_GetPerformanceCounter() - start) * 1000 / periods / voices;
+            double periodNs = period * 1000000000.0 / frequency;
+
+            printf("%-8s %-8s %6.1f %8d %18.1f %16.0f\n", run.name, run.mixer != NULL ? run.mixer->Kernels().name : "-",
+                   frequency / 1000.0, voices, perVoice, periodNs / perVoice);
+            delete run.mixer;
+        }
+    }
+}
+
+// Resamples ten seconds of stereo noise with SDL's converter, and with the in-house
+// resampler at every quality and kernel set, on one thread and split across every core
+void benchmarkResampling(void)
+{
+    const int rates[][2] = { { 48000, 44100 }, { 96000, 44100 }, { 44100, 48000 } };
+    const char *qualityNames[] = { "sdl", "fast", "medium", "best" };
+    const int seconds = 10;
+    int cores = SDL_GetCPUCount();
+
+    printf("%-8s %-8s %-12s %18s %18s\n", "quality", "kernels", "kHz", "Mframes/s/core", "Mframes/s on all");
+    for (const auto &rate : rates)
+    {
+        int inputFrames = seconds * rate[0];
+        char rateName[32];
+        snprintf(rateName, sizeof(rateName), "%.1f>%.1f", rate[0] / 1000.0, rate[1] / 1000.0);
+
+        // Padded for the widest filter; SDL's converter works on its own copy
+        std::vector<Sint16> input(2 * (inputFrames + 2 * 1024));
+        Sint16 *audio = input.data() + 2 * 1024;
+        Uint32 seed = 1;
+        for (int i = 0; i < 2 * inputFrames; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            audio[i] = (Sint16)(seed >> 16) / 4;
+        }
+
+        SDL_AudioCVT cvt;
+        if (SDL_BuildAudioCVT(&cvt, AUDIO_S16SYS, 2, rate[0], AUDIO_S16SYS, 2, rate[1]) >= 0)
+        {
+            std::vector<Uint8> buffer((size_t)inputFrames * 4 * cvt.len_mult);
+            memcpy(buffer.data(), audio, (size_t)inputFrames * 4);
+            cvt.buf = buffer.data();
+            cvt.len = inputFrames * 4;
+            Uint64 start = SDL_GetPerformanceCounter();
+            SDL_ConvertAudio(&cvt);
+            double rateSdl = cvt.len_cvt / 4 / ticksToMicroseconds(SDL_GetPerformanceCounter() - start);
+            printf("%-8s %-8s %-12s %18.2f %18s\n", "sdl", "-", rateName, rateSdl, "-");
+        }
+
+        for (int quality = RESAMPLE_FAST; quality <= RESAMPLE_BEST; quality++)
+        {
+            for (const MixKernels *kernels : SupportedMixKernels())
+            {
+                Resampler resampler(rate[0], rate[1], 2, (ResampleQuality)quality, *kernels);
+                int outputFrames = resampler.OutputFrames(inputFrames);
+                std::vector<Sint16> output(2 * outputFrames);
+
+                Uint64 start = SDL_GetPerformanceCounter();
+                resampler.Process(audio, output.data(), 0, outputFrames);
+                double single = outputFrames / ticksToMicroseconds(SDL_GetPerformanceCounter() - start);
+
+                start = SDL_GetPerformanceCounter();
+                resampler.ProcessParallel(audio, inputFrames, output.data(), cores);
+                double parallel = outputFrames / ticksToMicroseconds(SDL_GetPerformanceCounter() - start);
+
+                printf("%-8s %-8s %-12s %18.2f %18.2f\n", qualityNames[quality], kernels->name, rateName, single, parallel);
+            }
+        }
+    }
+    printf("All cores: %d\n", cores);
+}
+
+// A minimal HTTP/1.1 server on the loopback interface standing in for an asset server.
+// Paths are /<mode>/<bytes>: 'length' answers with a Content-Length and keeps the
+// connection open, 'close' closes it after every response, and 'chunked' sends the
+// body in the chunked transfer encoding, without announcing its length.
+int httpListener = -1;                         // Listening socket of the stand-in
+int httpPort = 0;                              // Port the stand-in listens on
+SDL_Thread *httpThread = NULL;                 // Accepts the stand-in's connections
+std::atomic<int> httpConnections(0);           // Connections the stand-in accepted so far
+
+bool sendAll(int socket, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Answers the requests of one connection until the client closes it
+int serveHttpConnection(void *data)
+{
+    int socket = (int)(intptr_t)data;
+    std::vector<char> body(64 * 1024, 'x');
+    std::string request;
+    char buffer[4096];
+
+    for (;;)
+    {
+        size_t end;
+        while ((end = request.find("\r\n\r\n")) == std::string::npos)
+        {
+            ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+            {
+                close(socket);
+                return 0;
+            }
+            request.append(buffer, received);
+        }
+
+        char mode[16] = "";
+        long bytes = 0;
+        sscanf(request.c_str(), "GET /%15[a-z]/%ld", mode, &bytes);
+        request.erase(0, end + 4);
+        bool keepAlive = strcmp(mode, "close") != 0;
+        bool chunked = strcmp(mode, "chunked") == 0;
+
+        char header[256];
+        if (chunked)
+        {
+            snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n\r\n");
+        }
+        else
+        {
+            snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\n%s\r\n",
+                     bytes, keepAlive ? "" : "Connection: close\r\n");
+        }
+        bool sent = sendAll(socket, header, strlen(header));
+        for (long remaining = bytes; sent && remaining > 0; remaining -= (long)body.size())
+        {
+            long length = std::min(remaining, (long)body.size());
+            if (chunked)
+            {
+                char size[32];
+                snprintf(size, sizeof(size), "%lx\r\n", length);
+                sent = sendAll(socket, size, strlen(size)) && sendAll(socket, body.data(), length) && sendAll(socket, "\r\n", 2);
+            }
+            else
+            {
+                sent = sendAll(socket, body.data(), length);
+            }
+        }
+        if (sent && chunked)
+        {
+            sent = sendAll(socket, "0\r\n\r\n", 5);
+        }
+        if (!sent || !keepAlive)
+        {
+            close(socket);
+            return 0;
+        }
+    }
+}
+
+int acceptHttpConnections(void *data)
+{
+    for (;;)
+    {
+        int socket = accept(httpListener, NULL, NULL);
+        if (socket < 0)
+        {
+            return 0;
+        }
+        httpConnections++;
+        SDL_Thread *thread = SDL_CreateThread(serveHttpConnection, "http", (void *)(intptr_t)socket);
+        if (thread == NULL)
+        {
+            close(socket);
+            continue;
+        }
+        SDL_DetachThread(thread);
+    }
+}
+
+bool startHttpStandIn(void)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+
+    httpListener = socket(AF_INET, SOCK_STREAM, 0);
+    if (httpListener < 0 || bind(httpListener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(httpListener, 64) != 0 || getsockname(httpListener, (struct sockaddr *)&address, &length) != 0)
+    {
+        fprintf(stderr, "Unable to start the HTTP stand-in server.\n");
+        return false;
+    }
+    httpPort = ntohs(address.sin_port);
+    httpThread = SDL_CreateThread(acceptHttpConnections, "http-accept", NULL);
+    return httpThread != NULL;
+}
+
+// Stops accepting; connections still open end when their client closes them
+void stopHttpStandIn(void)
+{
+    shutdown(httpListener, SHUT_RDWR);
+    close(httpListener);
+    SDL_WaitThread(httpThread, NULL);
+    httpThread = NULL;
+}
+
+std::string standInUri(const char *mode, long bytes)
+{
+    return "http://127.0.0.1:" + std::to_string(httpPort) + "/" + mode + "/" + std::to_string(bytes);
+}
+
+// Completion times of asynchronous fetches, filled in on the download thread
+struct AsyncFetch
+{
+    Uint64 started;
+    Uint64 finished;
+    std::atomic<int> *done;
+};
+
+void asyncFetched(SDL_RWops *rwops, void *userData)
+{
+    AsyncFetch *fetch = (AsyncFetch *)userData;
+    if (rwops != NULL)
+    {
+        SDL_RWclose(rwops);
+    }
+    fetch->finished = SDL_GetPerformanceCounter();
+    (*fetch->done)++;
+}
+
+void reportFetches(const char *name, const char *mode, std::vector<Uint64> &times, int connections)
+{
+    std::sort(times.begin(), times.end());
+    auto percentile = [&times](double p) { return ticksToMicroseconds(times[std::min(times.size() - 1, (size_t)(p * times.size()))]); };
+    printf("%-8s %-10s %8d %12.1f %12.1f %12.1f %12d\n", name, mode, (int)times.size(),
+           percentile(0.5), percentile(0.99), ticksToMicroseconds(times.back()), connections);
+}
+
+// Fetches a small file from the stand-in over and over, once on connections kept open
+// and reused through the shared connection cache and once on a new connection per
+// fetch, one at a time and all queued at once, and reports the latency of each fetch
+void benchmarkHttp(void)
+{
+    const int fetches = 1000;
+    const long bytes = 16 * 1024;
+    const char *modes[] = { "length", "close" };
+
+    printf("%-8s %-10s %8s %12s %12s %12s %12s\n", "fetch", "server", "fetches", "p50 us", "p99 us", "max us", "connections");
+    for (const char *mode : modes)
+    {
+        std::string uri = standInUri(mode, bytes);
+        std::vector<Uint64> times;
+
+        int connections = httpConnections;
+        for (int i = 0; i < fetches; i++)
+        {
+            Uint64 start = SDL_GetPerformanceCounter();
+            SDL_RWops *rwops = SDL_RWFromHttpSync(uri.c_str());
+            if (rwops == NULL)
+            {
+                fprintf(stderr, "Fetching '%s' failed: %s\n", uri.c_str(), SDL_GetError());
+                return;
+            }
+            SDL_RWclose(rwops);
+            times.push_back(SDL_GetPerformanceCounter() - start);
+        }
+        reportFetches("sync", mode, times, httpConnections - connections);
+
+        connections = httpConnections;
+        std::atomic<int> done(0);
+        std::vector<AsyncFetch> async(fetches);
+        for (auto &fetch : async)
+        {
+            fetch.done = &done;
+            fetch.started = SDL_GetPerformanceCounter();
+            if (SDL_RWFromHttpAsync(uri.c_str(), asyncFetched, &fetch) != 0)
+            {
+                fprintf(stderr, "Queueing '%s' failed: %s\n", uri.c_str(), SDL_GetError());
+                return;
+            }
+        }
+        while (done < fetches)
+        {
+            SDL_Delay(1);
+        }
+        times.clear();
+        for (const auto &fetch : async)
+        {
+            times.push_back(fetch.finished - fetch.started);
+        }
+        reportFetches("async", mode, times, httpConnections - connections);
+    }
+}
+
+// Downloads a 30 MB file, the default fetch limit, with a Content-Length and in the
+// chunked transfer encoding, whose buffer grows as the body arrives, and reports the
+// median throughput of a few downloads of each
+void benchmarkHttpThroughput(void)
+{
+    const int downloads = 5;
+    const long bytes = 30 * 1024 * 1024;
+    const char *modes[] = { "length", "chunked" };
+
+    printf("\n%-10s %10s %12s %12s\n", "server", "MB", "p50 ms", "MB/s");
+    for (const char *mode : modes)
+    {
+        std::string uri = standInUri(mode, bytes);
+        std::vector<Uint64> times;
+        for (int i = 0; i < downloads; i++)
+        {
+            Uint64 start = SDL_GetPerformanceCounter();
+            SDL_RWops *rwops = SDL_RWFromHttpSync(uri.c_str());
+            if (rwops == NULL)
+            {
+                fprintf(stderr, "Fetching '%s' failed: %s\n", uri.c_str(), SDL_GetError());
+                return;
+            }
+            times.push_back(SDL_GetPerformanceCounter() - start);
+            SDL_RWclose(rwops);
+        }
+
+        std::sort(times.begin(), times.end());
+        double median = ticksToMicroseconds(times[times.size() / 2]);
+        printf("%-10s %10.0f %12.1f %12.1f\n", mode, bytes / 1048576.0, median / 1000, bytes / median);
+    }
+}
+
+// Argument parsing function
+static int parse_opt(int key, char *arg, struct argp_state *state)
+{
+    switch (key)
+    {
+    case 's':
+        synthetic = atoi(arg);
+        if (synthetic < 1)
+        {
+            argp_error(state, "at least one synthetic command is required");
+        }
+        break;
+
+    case 'b':
+        binary = true;
+        break;
+
+    case 'D':
+        dispatchOnly = true;
+        break;
+
+    case 'M':
+        mixingOnly = true;
+        break;
+
+    case 'R':
+        resamplingOnly = true;
+        break;
+
+    case 'H':
+        httpOnly = true;
+        break;
+
+    case 'A':
+        allocationsOnly = true;
+        break;
+
+    case 210: // Mixer backend
+        if (strcmp(arg, "sdl") != 0 && strcmp(arg, "simd") != 0 && strcmp(arg, "simd16") != 0)
+        {
+            argp_error(state, "the mixer must be one of sdl, simd or simd16");
+        }
+        mixerBackend = arg;
+        break;
+
+    case 'u':
+        uriprefix = arg;
+        break;
+
+    case 201: // Loader threads
+        loadThreads = atoi(arg);
+        if (loadThreads < 1)
+        {
+            argp_error(state, "at least one loader thread is required");
+        }
+        break;
+
+    case ARGP_KEY_ARG:
+        if (!logFile.empty())
+        {
+            argp_usage(state);
+        }
+        logFile = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (logFile.empty() && synthetic == 0 && !dispatchOnly && !mixingOnly && !resamplingOnly && !httpOnly && !allocationsOnly)
+        {
+            argp_usage(state);
+        }
+        break;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct argp_option options[] =
+    {
+        {"synthetic", 's', "count", 0, "Replays this many generated commands instead of a command log"},
+        {"binary", 'b', 0, 0, "Replays the commands in the binary encoding instead of JSON"},
+        {"dispatch", 'D', 0, 0, "Only runs the command dispatch microbenchmark"},
+        {"mixing", 'M', 0, 0, "Only runs the mixing benchmark, SDL_mixer's mixing against the in-house mixer"},
+        {"resampling", 'R', 0, 0, "Only runs the resampling benchmark, SDL's converter against the in-house resampler"},
+        {"http", 'H', 0, 0, "Only runs the HTTP benchmarks, fetch latency on reused connections and download throughput"},
+        {"allocations", 'A', 0, 0, "Only checks that decoding and dispatching typical commands does not allocate once warmed up"},
+        {"mixer", 210, "mixer", 0, "Mixer the replayed commands play on: sdl (default), simd or simd16"},
+        {"uri-prefix", 'u', "prefix", 0, "Sets a prefix to be prepended to all sound file locations"},
+        {"load-threads", 201, "count", 0, "Number of background sample loader threads (default 2)"},
+        {0}
+    };
+
+    struct argp argp = {options, parse_opt, "[LOG.jsonl]", "Replays MQTT commands, one JSON payload per line, through the player's command path."};
+
+    int retval = argp_parse(&argp, argc, argv, 0, 0, 0);
+    if (retval != 0)
+    {
+        return retval;
+    }
+
+    if (dispatchOnly)
+    {
+        benchmarkDispatch();
+        return 0;
+    }
+    if (mixingOnly)
+    {
+        benchmarkMixing();
+        return 0;
+    }
+    if (resamplingOnly)
+    {
+        benchmarkResampling();
+        return 0;
+    }
+    if (allocationsOnly)
+    {
+        return checkAllocations() ? 0 : 1;
+    }
+    if (httpOnly)
+    {
+        if (SDL_RWHttpInit() != 0 || !startHttpStandIn())
+        {
+            return 1;
+        }
+        benchmarkHttp();
+        benchmarkHttpThroughput();
+        SDL_RWHttpShutdown();
+        stopHttpStandIn();
+        return 0;
+    }
+
+    std::vector<std::string> payloads;
+    if (!(logFile.empty() ? generateCommands(synthetic, payloads) : readCommands(logFile, payloads)))
+    {
+        return 1;
+    }
+    if (binary)
+    {
+        encodeBinary(payloads);
+    }
+
+    // Mix in real time on a device that discards the output
+    setenv("SDL_AUDIODRIVER", "dummy", true);
+    if (!initSDLAudio())
+    {
+        return 1;
+    }
+
+    stageLock = SDL_CreateMutex();
+    for (auto &times : stageTimes)
+    {
+        times.reserve(payloads.size());
+    }
+    stageRecorder = recordStage;
+
+    manager.SetLoadedCallback(sampleLoaded, NULL);
+    if (!manager.StartLoaders(loadThreads) || !startExecutor())
+    {
+        return 1;
+    }
+
+    topic = "bench";
+    std::vector<char> topicName(topic.c_str(), topic.c_str() + topic.size() + 1);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (auto &payload : payloads)
+    {
+        while (commandQueueFull())
+        {
+            SDL_Delay(0);
+        }
+
+        struct mosquitto_message message;
+        memset(&message, 0, sizeof(message));
+        message.topic = topicName.data();
+        message.payload = (void *)payload.data();
+        message.payloadlen = payload.size();
+        message_callback(NULL, NULL, &message);
+    }
+    while (!commandQueueEmpty())
+    {
+        SDL_Delay(0);
+    }
+    Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+
+    // Let the loads that are still running finish, so their times are reported too
+    Uint32 deadline = SDL_GetTicks() + 10000;
+    while (recordedCount(STAGE_LOAD) < manager.GetStats().misses && (Sint32)(SDL_GetTicks() - deadline) < 0)
+    {
+        SDL_Delay(1);
+    }
+
+    stageRecorder = NULL;
+    stopExecutor();
+    haltVoice(-1);
+    manager.StopLoaders();
+    manager.FreeAll();
+    Mix_CloseAudio();
+    SDL_RWHttpShutdown();
+    SDL_Quit();
+
+    double seconds = ticksToMicroseconds(elapsed) / 1000000.0;
+    printf("\n%d commands in %.3f s: %.0f commands/s\n\n", (int)payloads.size(), seconds, payloads.size() / seconds);
+    reportStages();
+    return 0;
+}
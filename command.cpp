@@ -0,0 +1,475 @@
+#include "command.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "SDL.h"
+#include "rapidjson/reader.h"
+
+using namespace rapidjson;
+
+// Value types a 'message' field can have
+enum FieldKind
+{
+    KIND_STRING,
+    KIND_INT,
+    KIND_FLOAT,
+    KIND_DOUBLE,
+    KIND_BOOL
+};
+
+// Where a 'message' field is decoded to
+struct FieldSpec
+{
+    const char *name;
+    SizeType length;
+    unsigned bit;
+    FieldKind kind;
+    size_t offset;                     // Offset of the member in Command
+};
+
+#define COMMAND_FIELD(name, bit, kind, member) { name, sizeof(name) - 1, bit, kind, offsetof(Command, member) }
+
+static constexpr FieldSpec fieldSpecs[] =
+{
+    COMMAND_FIELD("file", FIELD_FILE, KIND_STRING, file),
+    COMMAND_FIELD("channel", FIELD_CHANNEL, KIND_INT, channel),
+    COMMAND_FIELD("loop", FIELD_LOOP, KIND_BOOL, loop),
+    COMMAND_FIELD("volume", FIELD_VOLUME, KIND_FLOAT, volume),
+    COMMAND_FIELD("exclusive", FIELD_EXCLUSIVE, KIND_BOOL, exclusive),
+    COMMAND_FIELD("bgm", FIELD_BGM, KIND_BOOL, bgm),
+    COMMAND_FIELD("maxPlayLength", FIELD_MAX_PLAY_LENGTH, KIND_INT, maxPlayLength),
+    COMMAND_FIELD("nocache", FIELD_NOCACHE, KIND_BOOL, nocache),
+    COMMAND_FIELD("stream", FIELD_STREAM, KIND_BOOL, stream),
+    COMMAND_FIELD("time", FIELD_TIME, KIND_INT, time),
+    COMMAND_FIELD("sample", FIELD_SAMPLE, KIND_INT, sample),
+    COMMAND_FIELD("at", FIELD_AT, KIND_DOUBLE, at),
+    COMMAND_FIELD("delay", FIELD_DELAY, KIND_FLOAT, delay),
+    COMMAND_FIELD("pan", FIELD_PAN, KIND_FLOAT, pan),
+    COMMAND_FIELD("priority", FIELD_PRIORITY, KIND_INT, priority),
+    COMMAND_FIELD("id", FIELD_ID, KIND_INT, id),
+    COMMAND_FIELD("curve", FIELD_CURVE, KIND_STRING, curveName),
+    COMMAND_FIELD("fadeIn", FIELD_FADE_IN, KIND_INT, fadeIn),
+    COMMAND_FIELD("bus", FIELD_BUS, KIND_STRING, busName),
+    COMMAND_FIELD("keepBgm", FIELD_KEEP_BGM, KIND_BOOL, keepBgm),
+};
+
+// Command names of the binary opcodes, as looked up by the dispatcher
+static const char *const binaryCommandNames[] =
+{
+    NULL,
+    "play",
+    "stopall",
+    "fadeout",
+    "precache",
+    "cacheStats",
+    "soundSetVolume",
+    "soundPause",
+    "soundResume",
+    "setMasterVolume",
+};
+
+static_assert(SDL_arraysize(binaryCommandNames) == OPCODE_SET_MASTER_VOLUME + 1, "every opcode needs a command name");
+
+// Fields that travel as BinaryFlag bits rather than in the fields mask
+static const unsigned binaryFlagFields = FIELD_LOOP | FIELD_EXCLUSIVE | FIELD_BGM | FIELD_NOCACHE | FIELD_STREAM;
+
+// Fields the binary layout has no room for
+static const unsigned binaryMissingFields = FIELD_BATCH | FIELD_AT | FIELD_DELAY | FIELD_PAN | FIELD_PRIORITY | FIELD_ID | FIELD_CURVE | FIELD_FADE_IN | FIELD_BUS | FIELD_KEEP_BGM;
+
+// Every field bit has to be distinct for the 'fields' mask to make sense
+static constexpr bool fieldBitsUnique()
+{
+    unsigned seen = FIELD_BATCH;
+    for (const auto &spec : fieldSpecs)
+    {
+        if (seen & spec.bit)
+        {
+            return false;
+        }
+        seen |= spec.bit;
+    }
+    return true;
+}
+
+static_assert(fieldBitsUnique(), "command fields must have distinct bits");
+
+static const char *kindName(FieldKind kind)
+{
+    switch (kind)
+    {
+    case KIND_STRING: return "a string";
+    case KIND_INT: return "an int";
+    case KIND_FLOAT: return "a float";
+    case KIND_DOUBLE: return "a number";
+    case KIND_BOOL: return "a bool";
+    }
+    return "";
+}
+
+// SAX handler that fills a Command from the top level 'command' string and the
+// fields of the top level 'message' object; everything else is skipped.
+// The objects in the 'commands' array of a batch are decoded the same way, each
+// into its own Command of the batch.
+class CommandReaderHandler : public BaseReaderHandler<UTF8<>, CommandReaderHandler>
+{
+public:
+    CommandReaderHandler(Command &command, Command *batch, int batchCapacity) :
+        _root(command), _target(&command), _batch(batch), _batchCapacity(batchCapacity) {}
+
+    bool isObject = false;             // Whether the payload is a JSON object
+    bool batchOverflow = false;        // Whether a batch had more commands than fit
+
+    bool StartObject()
+    {
+        _depth++;
+        if (_depth == 1)
+        {
+            isObject = true;
+        }
+        else if (_batchDepth != 0 && _depth == _batchDepth + 1 && _target == &_root)
+        {
+            // Each object in the batch array is a command of its own
+            if (_root.batchCount == _batchCapacity)
+            {
+                batchOverflow = true;
+            }
+            else
+            {
+                _target = &_batch[_root.batchCount++];
+                memset(_target, 0, sizeof(*_target));
+                _base = _batchDepth;
+                _inMessage = false;
+            }
+        }
+        _inMessage = _inMessage || (_depth == _base + 2 && _key == KEY_MESSAGE);
+        _key = KEY_NONE;
+        _field = NULL;
+        return true;
+    }
+
+    bool EndObject(SizeType)
+    {
+        if (_depth == _base + 2)
+        {
+            _inMessage = false;
+        }
+        else if (_depth == _base + 1 && _target != &_root)
+        {
+            // Back in the batch array, which is inside the root's message
+            _target = &_root;
+            _base = 0;
+            _inMessage = true;
+        }
+        _depth--;
+        return true;
+    }
+
+    bool StartArray()
+    {
+        _depth++;
+        if (_key == KEY_COMMANDS && _target == &_root && _batchDepth == 0)
+        {
+            _batchDepth = _depth;
+            _root.fields |= FIELD_BATCH;
+        }
+        _key = KEY_NONE;
+        _field = NULL;
+        return true;
+    }
+
+    bool EndArray(SizeType)
+    {
+        if (_depth == _batchDepth)
+        {
+            _batchDepth = 0;
+        }
+        _depth--;
+        return true;
+    }
+
+    bool Key(const char *str, SizeType length, bool)
+    {
+        _key = KEY_NONE;
+        _field = NULL;
+        if (_depth == _base + 1)
+        {
+            if (length == 7 && memcmp(str, "command", 7) == 0)
+            {
+                _key = KEY_COMMAND;
+            }
+            else if (length == 7 && memcmp(str, "message", 7) == 0)
+            {
+                _key = KEY_MESSAGE;
+            }
+        }
+        else if (_depth == _base + 2 && _inMessage)
+        {
+            if (length == 8 && memcmp(str, "commands", 8) == 0)
+            {
+                _key = KEY_COMMANDS;
+                return true;
+            }
+
+            for (const auto &spec : fieldSpecs)
+            {
+                if (spec.length == length && memcmp(spec.name, str, length) == 0)
+                {
+                    _field = &spec;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool String(const char *str, SizeType, bool)
+    {
+        if (_key == KEY_COMMAND)
+        {
+            _target->name = str;
+        }
+        else if (_field != NULL && _field->kind == KIND_STRING)
+        {
+            *(const char **)Member() = str;
+            Found();
+        }
+        return Done();
+    }
+
+    bool Bool(bool value)
+    {
+        if (_field != NULL && _field->kind == KIND_BOOL)
+        {
+            *(bool *)Member() = value;
+            Found();
+        }
+        return Done();
+    }
+
+    bool Int(int value) { return Integer(value); }
+    bool Uint(unsigned value) { return Integer(value); }
+    bool Int64(int64_t value) { return Integer(value); }
+    bool Uint64(uint64_t value) { return value <= INT64_MAX ? Integer((int64_t)value) : Done(); }
+
+    bool Double(double value)
+    {
+        if (_field != NULL && _field->kind == KIND_FLOAT)
+        {
+            *(float *)Member() = (float)value;
+            Found();
+        }
+        else if (_field != NULL && _field->kind == KIND_DOUBLE)
+        {
+            *(double *)Member() = value;
+            Found();
+        }
+        return Done();
+    }
+
+    bool Default()
+    {
+        return Done();
+    }
+
+private:
+    enum CommandKey
+    {
+        KEY_NONE,
+        KEY_COMMAND,
+        KEY_MESSAGE,
+        KEY_COMMANDS
+    };
+
+    bool Integer(int64_t value)
+    {
+        if (_field != NULL && _field->kind == KIND_INT && value >= INT_MIN && value <= INT_MAX)
+        {
+            *(int *)Member() = (int)value;
+            Found();
+        }
+        else if (_field != NULL && _field->kind == KIND_FLOAT)
+        {
+            *(float *)Member() = (float)value;
+            Found();
+        }
+        else if (_field != NULL && _field->kind == KIND_DOUBLE)
+        {
+            *(double *)Member() = (double)value;
+            Found();
+        }
+        return Done();
+    }
+
+    void *Member()
+    {
+        return (char *)_target + _field->offset;
+    }
+
+    void Found()
+    {
+        _target->fields |= _field->bit;
+    }
+
+    // Called after every scalar value
+    bool Done()
+    {
+        _key = KEY_NONE;
+        _field = NULL;
+        return true;
+    }
+
+    Command &_root;
+    Command *_target;                  // Command being decoded, the root or one in its batch
+    Command *_batch;
+    int _batchCapacity;
+    int _depth = 0;
+    int _base = 0;                     // Depth the target command's object is nested in
+    int _batchDepth = 0;               // Depth of the batch array while inside it, 0 otherwise
+    bool _inMessage = false;           // Inside the target command's 'message' object
+    CommandKey _key = KEY_NONE;        // Key whose value comes next
+    const FieldSpec *_field = NULL;    // Message field whose value comes next
+};
+
+CommandDecoder::CommandDecoder() : _stackAllocator(_stackArena, sizeof(_stackArena))
+{
+}
+
+bool CommandDecoder::Decode(char *payload, size_t length, Command &command)
+{
+    memset(&command, 0, sizeof(command));
+
+    if (length > 0 && (uint8_t)payload[0] == BINARY_COMMAND_MAGIC)
+    {
+        return DecodeBinary(payload, length, command);
+    }
+    return DecodeJson(payload, command);
+}
+
+bool CommandDecoder::DecodeBinary(const char *payload, size_t length, Command &command)
+{
+    BinaryCommandHeader header;
+    if (length < sizeof(header))
+    {
+        fprintf(stderr, "Binary command is %u bytes long, expected at least %u.\n", (unsigned)length, (unsigned)sizeof(header));
+        return false;
+    }
+    memcpy(&header, payload, sizeof(header));
+
+    if (header.opcode == 0 || header.opcode >= SDL_arraysize(binaryCommandNames))
+    {
+        fprintf(stderr, "Unknown binary command opcode %u.\n", header.opcode);
+        return false;
+    }
+
+    command.name = binaryCommandNames[header.opcode];
+    command.channel = (int16_t)SDL_SwapLE16(header.channel);
+    command.sample = SDL_SwapLE16(header.sample);
+    command.volume = SDL_SwapFloatLE(header.volume);
+    command.maxPlayLength = (int32_t)SDL_SwapLE32(header.maxPlayLength);
+    command.time = (int32_t)SDL_SwapLE32(header.time);
+    command.loop = (header.flags & FLAG_LOOP) != 0;
+    command.exclusive = (header.flags & FLAG_EXCLUSIVE) != 0;
+    command.bgm = (header.flags & FLAG_BGM) != 0;
+    command.nocache = (header.flags & FLAG_NOCACHE) != 0;
+    command.stream = (header.flags & FLAG_STREAM) != 0;
+    command.fields = (SDL_SwapLE16(header.fields) & ~(FIELD_FILE | binaryMissingFields | binaryFlagFields)) | binaryFlagFields;
+
+    // The URI runs up to the end of the payload, where the caller put a NUL
+    if (length > sizeof(header))
+    {
+        command.file = payload + sizeof(header);
+        command.fields |= FIELD_FILE;
+    }
+    return true;
+}
+
+bool CommandDecoder::DecodeJson(char *payload, Command &command)
+{
+    CommandReaderHandler handler(command, _batch, SDL_arraysize(_batch));
+    bool parsed;
+    {
+        GenericReader<UTF8<>, UTF8<>, MemoryPoolAllocator<> > reader(&_stackAllocator, sizeof(_stackArena) / 2);
+        InsituStringStream stream(payload);
+        parsed = !reader.Parse<kParseInsituFlag>(stream, handler).IsError();
+    }
+    _stackAllocator.Clear();
+
+    if (!parsed || !handler.isObject)
+    {
+        fprintf(stderr, "Message is not a valid object.\n");
+        return false;
+    }
+
+    if (handler.batchOverflow)
+    {
+        fprintf(stderr, "Batch has more than %d commands.\n", (int)SDL_arraysize(_batch));
+        return false;
+    }
+    command.batch = command.batchCount > 0 ? _batch : NULL;
+
+    if (command.name == NULL)
+    {
+        fprintf(stderr, "Message does not have a 'command' property that is a string.\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool CommandHasFields(const Command &command, unsigned required)
+{
+    if ((required & FIELD_BATCH) && !command.has(FIELD_BATCH))
+    {
+        fprintf(stderr, "Message does not have a 'message.commands' property that is an array.\n");
+        return false;
+    }
+
+    for (const auto &field : fieldSpecs)
+    {
+        if ((required & field.bit) && !command.has(field.bit))
+        {
+            fprintf(stderr, "Message does not have a 'message.%s' property that is %s.\n", field.name, kindName(field.kind));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EncodeBinaryCommand(const Command &command, std::string &payload)
+{
+    uint8_t opcode = 0;
+    for (size_t i = 1; i < SDL_arraysize(binaryCommandNames); i++)
+    {
+        if (strcasecmp(binaryCommandNames[i], command.name) == 0)
+        {
+            opcode = i;
+            break;
+        }
+    }
+    if (opcode == 0 || (command.fields & binaryMissingFields) != 0)
+    {
+        return false;
+    }
+
+    BinaryCommandHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BINARY_COMMAND_MAGIC;
+    header.opcode = opcode;
+    header.fields = SDL_SwapLE16(command.fields & ~(FIELD_FILE | binaryFlagFields));
+    header.channel = SDL_SwapLE16(command.channel);
+    header.sample = SDL_SwapLE16(command.sample);
+    header.volume = SDL_SwapFloatLE(command.volume);
+    header.maxPlayLength = SDL_SwapLE32(command.maxPlayLength);
+    header.time = SDL_SwapLE32(command.time);
+    header.flags = (command.loop ? FLAG_LOOP : 0) | (command.exclusive ? FLAG_EXCLUSIVE : 0) | (command.bgm ? FLAG_BGM : 0) |
+                   (command.nocache ? FLAG_NOCACHE : 0) | (command.stream ? FLAG_STREAM : 0);
+
+    payload.append((const char *)&header, sizeof(header));
+    if (command.has(FIELD_FILE))
+    {
+        payload.append(command.file);
+    }
+    return true;
+}
@@ -0,0 +1,263 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include <string>
+
+#include "rapidjson/allocators.h"
+
+// One bit per 'message' field, set when the field was present with the expected type
+enum CommandField
+{
+    FIELD_FILE            = 1 << 0,
+    FIELD_CHANNEL         = 1 << 1,
+    FIELD_LOOP            = 1 << 2,
+    FIELD_VOLUME          = 1 << 3,
+    FIELD_EXCLUSIVE       = 1 << 4,
+    FIELD_BGM             = 1 << 5,
+    FIELD_MAX_PLAY_LENGTH = 1 << 6,
+    FIELD_NOCACHE         = 1 << 7,
+    FIELD_STREAM          = 1 << 8,
+    FIELD_TIME            = 1 << 9,
+    FIELD_SAMPLE          = 1 << 10,
+    FIELD_BATCH           = 1 << 11,   // 'commands' array of a batch
+    FIELD_AT              = 1 << 12,
+    FIELD_DELAY           = 1 << 13,
+    FIELD_PAN             = 1 << 14,
+    FIELD_PRIORITY        = 1 << 15,
+    FIELD_ID              = 1 << 16,
+    FIELD_CURVE           = 1 << 17,
+    FIELD_FADE_IN         = 1 << 18,
+    FIELD_BUS             = 1 << 19,
+    FIELD_KEEP_BGM        = 1 << 20
+};
+
+// Max. number of commands in a batch
+#define MAX_BATCH_COMMANDS 32
+
+// A command decoded from its JSON payload. Fields not flagged in 'fields' are
+// left zeroed, so the handler of each command applies its own defaults.
+// Strings point into the payload the command was decoded from.
+struct Command
+{
+    const char *name;                  // Command name as received
+    unsigned fields;                   // CommandField bits of the fields present
+    const char *file;
+    int channel;
+    bool loop;
+    float volume;
+    float pan;
+    int priority;                      // Voices of lower priority are stolen first
+    int id;                            // Controller's reference, echoed in voice status reports
+    bool exclusive;
+    bool bgm;
+    const char *busName;               // Bus of voices, resolved to 'bus' before dispatch
+    int bus;                           // Index of the bus, only meaningful with FIELD_BUS
+    bool keepBgm;                      // Whether stopping all voices spares the background music bus
+    int maxPlayLength;
+    bool nocache;
+    bool stream;
+    int time;
+    const char *curveName;             // Shape of a volume ramp or fade in, resolved to 'curve' before dispatch
+    int curve;                         // RampCurve
+    int fadeIn;                        // Time in ms a play fades in over
+    int sample;                        // Numeric sample reference, resolved to 'file' before dispatch
+    Command *batch;                    // Commands of a batch, owned by the decoder
+    int batchCount;
+    double at;                         // Unix time in ms the command takes effect at
+    float delay;                       // Time in ms after 'at', or after its arrival, the command takes effect
+    uint64_t received;                 // Performance counter at arrival, set before dispatch
+    uint64_t startFrame;               // Mixer frame 'at' and 'delay' resolve to, 0 to take effect at once
+    unsigned group;                    // Batch whose plays start together, set before dispatch; 0 if none
+
+    bool has(unsigned field) const { return (fields & field) == field; }
+};
+
+// Checks that a command has all the required fields; prints the first missing one
+bool CommandHasFields(const Command &command, unsigned required);
+
+// Appends the binary encoding of a command; returns false for commands it cannot carry,
+// batches and scheduled commands among them
+bool EncodeBinaryCommand(const Command &command, std::string &payload);
+
+// Executes a command whose required fields are present
+typedef bool (*CommandHandler)(const Command &command);
+
+// A command name, the 'message' fields it requires and its handler
+struct CommandSpec
+{
+    const char *name;
+    unsigned required;
+    CommandHandler handler;
+};
+
+// Case-insensitive perfect hash from command names to their specs, built at compile time:
+// the constructor searches for a seed that gives every name its own slot, so a lookup
+// is one hash of the name and a single comparison.
+template <size_t N>
+class CommandDispatch
+{
+public:
+    constexpr CommandDispatch(const CommandSpec (&specs)[N])
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            for (size_t j = 0; j < i; j++)
+            {
+                if (Equal(specs[i].name, specs[j].name))
+                {
+                    throw "duplicate command name";
+                }
+            }
+        }
+
+        for (uint32_t seed = 0; seed < 0x10000; seed++)
+        {
+            if (Build(specs, seed))
+            {
+                return;
+            }
+        }
+        throw "no perfect hash found for the command names";
+    }
+
+    // Returns the spec of a command, or NULL if there is no such command
+    const CommandSpec *Find(const char *name) const
+    {
+        const CommandSpec *spec = _slots[Hash(_seed, name) & (Slots - 1)];
+        return spec != NULL && strcasecmp(spec->name, name) == 0 ? spec : NULL;
+    }
+
+private:
+    // At least twice as many slots as commands, so a seed is found quickly
+    static constexpr size_t SlotsFor(size_t count)
+    {
+        size_t slots = 1;
+        while (slots < count * 2)
+        {
+            slots <<= 1;
+        }
+        return slots;
+    }
+
+    static constexpr size_t Slots = SlotsFor(N);
+
+    static constexpr char Fold(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+
+    static constexpr bool Equal(const char *a, const char *b)
+    {
+        while (*a != '\0' && Fold(*a) == Fold(*b))
+        {
+            a++;
+            b++;
+        }
+        return Fold(*a) == Fold(*b);
+    }
+
+    // FNV-1a over the case-folded name, perturbed by the seed
+    static constexpr uint32_t Hash(uint32_t seed, const char *name)
+    {
+        uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (; *name != '\0'; name++)
+        {
+            hash = (hash ^ (uint8_t)Fold(*name)) * 16777619u;
+        }
+        return hash ^ (hash >> 16);
+    }
+
+    constexpr bool Build(const CommandSpec (&specs)[N], uint32_t seed)
+    {
+        for (size_t slot = 0; slot < Slots; slot++)
+        {
+            _slots[slot] = NULL;
+        }
+        for (size_t i = 0; i < N; i++)
+        {
+            size_t slot = Hash(seed, specs[i].name) & (Slots - 1);
+            if (_slots[slot] != NULL)
+            {
+                return false;
+            }
+            _slots[slot] = &specs[i];
+        }
+        _seed = seed;
+        return true;
+    }
+
+    uint32_t _seed = 0;
+    const CommandSpec *_slots[Slots] = {};
+};
+
+// First byte of a binary encoded command; JSON payloads can never start with it
+#define BINARY_COMMAND_MAGIC 0xB1
+
+// Fixed layout of a binary encoded command, little-endian. The file URI, if any,
+// is not NUL-terminated and takes up the rest of the payload.
+struct BinaryCommandHeader
+{
+    uint8_t magic;                     // BINARY_COMMAND_MAGIC
+    uint8_t opcode;                    // BinaryOpcode
+    uint16_t fields;                   // CommandField bits of the fields present
+    int16_t channel;
+    uint16_t sample;
+    float volume;
+    int32_t maxPlayLength;
+    int32_t time;
+    uint8_t flags;                     // BinaryFlag bits
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(BinaryCommandHeader) == 24, "the binary command layout must not change");
+
+// Commands in the binary encoding
+enum BinaryOpcode
+{
+    OPCODE_PLAY = 1,
+    OPCODE_STOP_ALL,
+    OPCODE_FADE_OUT,
+    OPCODE_PRECACHE,
+    OPCODE_CACHE_STATS,
+    OPCODE_SET_VOLUME,
+    OPCODE_PAUSE,
+    OPCODE_RESUME,
+    OPCODE_SET_MASTER_VOLUME
+};
+
+// Boolean fields in the binary encoding
+enum BinaryFlag
+{
+    FLAG_LOOP      = 1 << 0,
+    FLAG_EXCLUSIVE = 1 << 1,
+    FLAG_BGM       = 1 << 2,
+    FLAG_NOCACHE   = 1 << 3,
+    FLAG_STREAM    = 1 << 4
+};
+
+// Decodes JSON payloads, streamed straight into Command structs with a SAX parser so
+// no DOM is built, and binary payloads, recognized by their first byte.
+// Each thread that decodes commands needs its own decoder, which owns the parse stack arena.
+class CommandDecoder
+{
+public:
+    CommandDecoder();
+
+    // Decodes a payload of the given length in place; the payload must be followed by a NUL.
+    // Prints the reason and returns false if the payload is not a valid command.
+    bool Decode(char *payload, size_t length, Command &command);
+
+private:
+    bool DecodeJson(char *payload, Command &command);
+    bool DecodeBinary(const char *payload, size_t length, Command &command);
+
+    Command _batch[MAX_BATCH_COMMANDS];
+    char _stackArena[1024];
+    rapidjson::MemoryPoolAllocator<> _stackAllocator;
+};
+
+#endif
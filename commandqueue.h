@@ -0,0 +1,65 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded single-producer/single-consumer ring used to hand commands from the
+// MQTT network thread to the command executor thread without locking.
+//
+// Slots are reused in place: the producer fills the slot returned by
+// BeginPush() and publishes it with EndPush(); the consumer reads the slot
+// returned by Front() and releases it with Pop().
+template <typename T, size_t Capacity>
+class CommandQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer side: returns the next free slot, or NULL if the queue is full.
+    T *BeginPush()
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == Capacity)
+        {
+            return NULL;
+        }
+        return &_slots[head & (Capacity - 1)];
+    }
+
+    // Producer side: publishes the slot returned by the last BeginPush().
+    void EndPush()
+    {
+        _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer side: returns the oldest published slot, or NULL if the queue is empty.
+    T *Front()
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+        {
+            return NULL;
+        }
+        return &_slots[tail & (Capacity - 1)];
+    }
+
+    // Consumer side: hands the slot returned by Front() back to the producer.
+    void Pop()
+    {
+        _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Either side: whether every published slot has been popped.
+    bool Empty() const
+    {
+        return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+    }
+
+private:
+    T _slots[Capacity];
+    alignas(64) std::atomic<size_t> _head{0};
+    alignas(64) std::atomic<size_t> _tail{0};
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "gainramp.h"
+
+#include <math.h>
+#include <strings.h>
+
+// Frames between the points a curve is followed through; straight pieces this short
+// are indistinguishable from the curve
+#define RAMP_PIECE_FRAMES 64
+
+// Frames converted at a time by Apply(), so its float buffer fits on the stack
+#define APPLY_BLOCK_FRAMES 256
+
+// Gain exponential ramps start from or end at instead of silence, which has no level in decibels
+#define EXPONENTIAL_FLOOR 0.001f
+
+void GainRamp::Set(float gain)
+{
+    _gain = gain;
+    _start = gain;
+    _target = gain;
+    _length = 0;
+    _elapsed = 0;
+    _delay = 0;
+}
+
+void GainRamp::Start(float target, int frames, RampCurve curve, int delay)
+{
+    if (frames <= 0 && delay <= 0)
+    {
+        Set(target);
+        return;
+    }
+    _start = _gain;
+    _target = target;
+    _length = SDL_max(frames, 0);
+    _elapsed = 0;
+    _delay = SDL_max(delay, 0);
+    _curve = curve;
+}
+
+float GainRamp::At(int elapsed) const
+{
+    if (elapsed >= _length)
+    {
+        return _target;
+    }
+
+    float x = (float)elapsed / _length;
+    switch (_curve)
+    {
+    case CURVE_EXPONENTIAL:
+    {
+        float from = SDL_max(_start, EXPONENTIAL_FLOOR);
+        float to = SDL_max(_target, EXPONENTIAL_FLOOR);
+        return from * powf(to / from, x);
+    }
+    case CURVE_EQUAL_POWER:
+        return sqrtf(_start * _start * (1.0f - x) + _target * _target * x);
+    default:
+        return _start + (_target - _start) * x;
+    }
+}
+
+int GainRamp::Next(int frames, float *gain, float *step)
+{
+    *gain = _gain;
+    if (_delay > 0)
+    {
+        // The current gain holds until the ramp starts, or steps to the target if it has no length
+        int count = SDL_min(frames, _delay);
+        _delay -= count;
+        if (_delay == 0 && _length == 0)
+        {
+            _gain = _target;
+        }
+        *step = 0.0f;
+        return count;
+    }
+    if (!Ramping())
+    {
+        *step = 0.0f;
+        return frames;
+    }
+
+    int count = SDL_min(frames, _length - _elapsed);
+    count = SDL_min(count, RAMP_PIECE_FRAMES - _elapsed % RAMP_PIECE_FRAMES);
+    _elapsed += count;
+    _gain = At(_elapsed);
+    *step = (_gain - *gain) / count;
+    return count;
+}
+
+void GainRamp::Apply(Sint16 *samples, int frames, int channels, const MixKernels &kernels)
+{
+    if (!Ramping() && _gain == 1.0f)
+    {
+        return;
+    }
+
+    float block[2 * APPLY_BLOCK_FRAMES];
+    while (frames > 0)
+    {
+        float gain;
+        float step;
+        int count = Next(SDL_min(frames, APPLY_BLOCK_FRAMES), &gain, &step);
+
+        if (channels == 2)
+        {
+            // Mixing into silence scales the samples, and converting back saturates them
+            memset(block, 0, 2 * count * sizeof(float));
+            kernels.mixFloat(block, samples, count, { gain, gain, step, step });
+            kernels.toInt16(samples, block, 2 * count);
+        }
+        else
+        {
+            for (int i = 0; i < count * channels; i++)
+            {
+                float value = samples[i] * (gain + step * (i / channels));
+                samples[i] = (Sint16)lrintf(SDL_max(-32768.0f, SDL_min(32767.0f, value)));
+            }
+        }
+
+        samples += channels * count;
+        frames -= count;
+    }
+}
+
+bool ParseRampCurve(const char *name, RampCurve *curve)
+{
+    if (strcasecmp(name, "linear") == 0)
+    {
+        *curve = CURVE_LINEAR;
+    }
+    else if (strcasecmp(name, "exponential") == 0)
+    {
+        *curve = CURVE_EXPONENTIAL;
+    }
+    else if (strcasecmp(name, "equalPower") == 0)
+    {
+        *curve = CURVE_EQUAL_POWER;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
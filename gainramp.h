@@ -0,0 +1,57 @@
+#ifndef GAINRAMP_H
+#define GAINRAMP_H
+
+#include "SDL.h"
+#include "mixkernel.h"
+
+// Shape of a gain ramp
+enum RampCurve
+{
+    CURVE_LINEAR,                              // Straight from one gain to the other
+    CURVE_EXPONENTIAL,                         // Evenly in decibels, down to -60 dB
+    CURVE_EQUAL_POWER                          // Power changes linearly, as in a crossfade
+};
+
+// A gain that moves to a target over a number of frames along a curve, followed in
+// straight pieces so vectorized kernels can apply it frame by frame. Ramps belong to
+// the audio thread, so they are only changed with the mixer locked.
+class GainRamp
+{
+public:
+    explicit GainRamp(float gain = 1.0f) : _gain(gain), _start(gain), _target(gain) {}
+
+    // Jumps to a gain, ending any ramp
+    void Set(float gain);
+
+    // Moves from the current gain to a target over the given frames, after holding the
+    // current gain for delay frames; a ramp of no frames steps to the target
+    void Start(float target, int frames, RampCurve curve, int delay = 0);
+
+    float Gain() const { return _gain; }
+    float Target() const { return _target; }
+    bool Ramping() const { return _delay > 0 || _elapsed < _length; }
+
+    // Takes the next straight piece of the ramp, at most the given frames long; returns
+    // its length, with the gain it starts at and its change per frame
+    int Next(int frames, float *gain, float *step);
+
+    // Applies the ramp to interleaved 16 bit samples in place, advancing it; stereo
+    // samples go through the vectorized kernels
+    void Apply(Sint16 *samples, int frames, int channels = 2, const MixKernels &kernels = BestMixKernels());
+
+private:
+    float At(int elapsed) const;
+
+    float _gain;
+    float _start;
+    float _target;
+    int _length = 0;
+    int _elapsed = 0;
+    int _delay = 0;                            // Frames left before the ramp starts
+    RampCurve _curve = CURVE_LINEAR;
+};
+
+// Parses a curve name; returns false for names it does not know
+bool ParseRampCurve(const char *name, RampCurve *curve);
+
+#endif
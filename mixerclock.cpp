@@ -0,0 +1,57 @@
+#include "mixerclock.h"
+
+void MixerClock::Start(int frequency, int frameBytes)
+{
+    _frequency = frequency;
+    _frameBytes = frameBytes;
+    _ticksPerFrame = (double)SDL_GetPerformanceFrequency() / frequency;
+    _frames.store(0, std::memory_order_relaxed);
+    _origin.store(0, std::memory_order_relaxed);
+    _lastMixed = 0;
+    _xruns.store(0, std::memory_order_relaxed);
+}
+
+void MixerClock::Mixed(int bytes)
+{
+    uint64_t frames = _frames.load(std::memory_order_relaxed) + bytes / _frameBytes;
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    double period = bytes / _frameBytes * _ticksPerFrame;
+    if (_lastMixed != 0 && now - _lastMixed > 2 * period)
+    {
+        _xruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    _lastMixed = now;
+
+    // Periods are mixed whenever the device asks for them, which jitters with scheduling;
+    // averaging the implied start of the count over a few dozen periods evens that out
+    double origin = now - frames * _ticksPerFrame;
+    double smoothed = _origin.load(std::memory_order_relaxed);
+    _origin.store(smoothed == 0 ? origin : smoothed + (origin - smoothed) / 32, std::memory_order_relaxed);
+
+    _frames.store(frames, std::memory_order_release);
+}
+
+uint64_t MixerClock::FrameAt(Uint64 counter) const
+{
+    uint64_t next = Frames();
+    double origin = _origin.load(std::memory_order_relaxed);
+    if (origin == 0 || counter <= origin)
+    {
+        return next;
+    }
+
+    uint64_t frame = (uint64_t)((counter - origin) / _ticksPerFrame);
+    return frame > next ? frame : next;
+}
+
+Sint32 MixerClock::MillisecondsUntil(uint64_t frame) const
+{
+    uint64_t now = Frames();
+    if (frame <= now || _frequency == 0)
+    {
+        return 0;
+    }
+    uint64_t ms = (frame - now) * 1000 / _frequency;
+    return ms < INT32_MAX ? (Sint32)ms : INT32_MAX;
+}
@@ -0,0 +1,50 @@
+#ifndef MIXERCLOCK_H
+#define MIXERCLOCK_H
+
+#include <atomic>
+#include <stdint.h>
+
+#include "SDL.h"
+
+// Counts the frames SDL_mixer has mixed, advanced from its post-mix callback, and
+// relates them to the performance counter so commands can be scheduled on a frame.
+// While the mixer is locked the count does not move, and the next mixing period
+// starts exactly at Frames().
+class MixerClock
+{
+public:
+    // Sets the output format and starts counting from zero; called whenever the audio
+    // device has been opened
+    void Start(int frequency, int frameBytes);
+
+    // Called from the post-mix callback with the number of bytes just mixed
+    void Mixed(int bytes);
+
+    // Frames mixed so far
+    uint64_t Frames() const { return _frames.load(std::memory_order_acquire); }
+
+    // Frame being mixed at the given performance counter value, estimated from the
+    // smoothed time of past mixing periods; never before the next period
+    uint64_t FrameAt(Uint64 counter) const;
+
+    // Milliseconds until the mixer gets to a frame, 0 if it already has
+    Sint32 MillisecondsUntil(uint64_t frame) const;
+
+    // Periods that came later than the device's buffer of two periods lasts, so the
+    // device likely ran dry
+    uint64_t Xruns() const { return _xruns.load(std::memory_order_relaxed); }
+
+    int Frequency() const { return _frequency; }
+    int FrameBytes() const { return _frameBytes; }
+
+private:
+    int _frequency = 0;
+    int _frameBytes = 0;
+    double _ticksPerFrame = 0;
+    std::atomic<uint64_t> _frames{0};
+    std::atomic<double> _origin{0};            // Counter value of frame 0, 0 until the first period
+    Uint64 _lastMixed = 0;                     // Counter value the last period was mixed at, audio thread only
+    std::atomic<uint64_t> _xruns{0};
+};
+
+#endif
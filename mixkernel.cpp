@@ -0,0 +1,409 @@
+#include "mixkernel.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIXKERNEL_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static inline Sint16 saturate(float value)
+{
+    if (value >= 32767.0f) return 32767;
+    if (value <= -32768.0f) return -32768;
+    return (Sint16)lrintf(value);
+}
+
+// Plain C kernels, also used for the frames left over by the vector loops
+
+static void mixFloatScalar(float *accumulator, const Sint16 *source, int frames, StereoGain gain)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        accumulator[2 * i] += source[2 * i] * gain.left;
+        accumulator[2 * i + 1] += source[2 * i + 1] * gain.right;
+        gain.left += gain.leftStep;
+        gain.right += gain.rightStep;
+    }
+}
+
+static void mixInt16Scalar(Sint16 *destination, const Sint16 *source, int frames, float left, float right)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        destination[2 * i] = saturate(destination[2 * i] + source[2 * i] * left);
+        destination[2 * i + 1] = saturate(destination[2 * i + 1] + source[2 * i + 1] * right);
+    }
+}
+
+static void toFloatScalar(float *destination, const Sint16 *source, int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        destination[i] = source[i];
+    }
+}
+
+static void toInt16Scalar(Sint16 *destination, const float *source, int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        destination[i] = saturate(source[i]);
+    }
+}
+
+static void filterScalar(const Sint16 *source, const float *coefficients, int samples, float sums[2])
+{
+    float even = 0.0f;
+    float odd = 0.0f;
+    for (int i = 0; i < samples; i += 2)
+    {
+        even += source[i] * coefficients[i];
+        odd += source[i + 1] * coefficients[i + 1];
+    }
+    sums[0] = even;
+    sums[1] = odd;
+}
+
+// Moves a ramping gain on by a number of frames
+static inline StereoGain advance(StereoGain gain, int frames)
+{
+    gain.left += gain.leftStep * frames;
+    gain.right += gain.rightStep * frames;
+    return gain;
+}
+
+static const MixKernels scalarKernels = { "scalar", mixFloatScalar, mixInt16Scalar, toFloatScalar, toInt16Scalar, filterScalar };
+
+#ifdef MIXKERNEL_X86
+
+// SSE2 kernels, four frames at a time. Like the plain C ones, the 16 bit kernel adds
+// in 32 bits and only saturates the sum.
+
+// Sign-extends the low or high four samples of a vector
+#define SSE2_LOW_INTS(samples) _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16)
+#define SSE2_HIGH_INTS(samples) _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16)
+#define SSE2_LOW_FLOATS(samples) _mm_cvtepi32_ps(SSE2_LOW_INTS(samples))
+#define SSE2_HIGH_FLOATS(samples) _mm_cvtepi32_ps(SSE2_HIGH_INTS(samples))
+
+__attribute__((target("sse2")))
+static void mixFloatSse2(float *accumulator, const Sint16 *source, int frames, StereoGain gain)
+{
+    __m128 step2 = _mm_setr_ps(2 * gain.leftStep, 2 * gain.rightStep, 2 * gain.leftStep, 2 * gain.rightStep);
+    __m128 step4 = _mm_add_ps(step2, step2);
+    __m128 gain0 = _mm_setr_ps(gain.left, gain.right, gain.left + gain.leftStep, gain.right + gain.rightStep);
+    __m128 gain1 = _mm_add_ps(gain0, step2);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i samples = _mm_loadu_si128((const __m128i *)(source + 2 * i));
+        float *out = accumulator + 2 * i;
+        _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(SSE2_LOW_FLOATS(samples), gain0)));
+        _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(SSE2_HIGH_FLOATS(samples), gain1)));
+        gain0 = _mm_add_ps(gain0, step4);
+        gain1 = _mm_add_ps(gain1, step4);
+    }
+    mixFloatScalar(accumulator + 2 * i, source + 2 * i, frames - i, advance(gain, i));
+}
+
+__attribute__((target("sse2")))
+static void mixInt16Sse2(Sint16 *destination, const Sint16 *source, int frames, float left, float right)
+{
+    __m128 gain = _mm_setr_ps(left, right, left, right);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i samples = _mm_loadu_si128((const __m128i *)(source + 2 * i));
+        __m128i *out = (__m128i *)(destination + 2 * i);
+        __m128i mixed = _mm_loadu_si128(out);
+        __m128i low = _mm_add_epi32(SSE2_LOW_INTS(mixed), _mm_cvtps_epi32(_mm_mul_ps(SSE2_LOW_FLOATS(samples), gain)));
+        __m128i high = _mm_add_epi32(SSE2_HIGH_INTS(mixed), _mm_cvtps_epi32(_mm_mul_ps(SSE2_HIGH_FLOATS(samples), gain)));
+        _mm_storeu_si128(out, _mm_packs_epi32(low, high));
+    }
+    mixInt16Scalar(destination + 2 * i, source + 2 * i, frames - i, left, right);
+}
+
+__attribute__((target("sse2")))
+static void toFloatSse2(float *destination, const Sint16 *source, int samples)
+{
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i *)(source + i));
+        _mm_storeu_ps(destination + i, SSE2_LOW_FLOATS(values));
+        _mm_storeu_ps(destination + i + 4, SSE2_HIGH_FLOATS(values));
+    }
+    toFloatScalar(destination + i, source + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+static void toInt16Sse2(Sint16 *destination, const float *source, int samples)
+{
+    // Clamp before converting, out of range floats would convert to INT_MIN
+    __m128 lowest = _mm_set1_ps(-32768.0f);
+    __m128 highest = _mm_set1_ps(32767.0f);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i low = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(source + i), lowest), highest));
+        __m128i high = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(source + i + 4), lowest), highest));
+        _mm_storeu_si128((__m128i *)(destination + i), _mm_packs_epi32(low, high));
+    }
+    toInt16Scalar(destination + i, source + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+static void filterSse2(const Sint16 *source, const float *coefficients, int samples, float sums[2])
+{
+    __m128 low = _mm_setzero_ps();
+    __m128 high = _mm_setzero_ps();
+    for (int i = 0; i < samples; i += 8)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i *)(source + i));
+        low = _mm_add_ps(low, _mm_mul_ps(SSE2_LOW_FLOATS(values), _mm_loadu_ps(coefficients + i)));
+        high = _mm_add_ps(high, _mm_mul_ps(SSE2_HIGH_FLOATS(values), _mm_loadu_ps(coefficients + i + 4)));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(low, high));
+    sums[0] = lanes[0] + lanes[2];
+    sums[1] = lanes[1] + lanes[3];
+}
+
+static const MixKernels sse2Kernels = { "sse2", mixFloatSse2, mixInt16Sse2, toFloatSse2, toInt16Sse2, filterSse2 };
+
+// AVX2 kernels, eight frames at a time; packing works within 128 bit lanes, so packed
+// results are put back in order with a permute
+
+#define AVX2_FLOATS(samples) _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(samples))
+
+__attribute__((target("avx2")))
+static void mixFloatAvx2(float *accumulator, const Sint16 *source, int frames, StereoGain gain)
+{
+    float l = gain.left, r = gain.right, ls = gain.leftStep, rs = gain.rightStep;
+    __m256 step4 = _mm256_setr_ps(4 * ls, 4 * rs, 4 * ls, 4 * rs, 4 * ls, 4 * rs, 4 * ls, 4 * rs);
+    __m256 step8 = _mm256_add_ps(step4, step4);
+    __m256 gain0 = _mm256_setr_ps(l, r, l + ls, r + rs, l + 2 * ls, r + 2 * rs, l + 3 * ls, r + 3 * rs);
+    __m256 gain1 = _mm256_add_ps(gain0, step4);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i low = _mm_loadu_si128((const __m128i *)(source + 2 * i));
+        __m128i high = _mm_loadu_si128((const __m128i *)(source + 2 * i + 8));
+        float *out = accumulator + 2 * i;
+        _mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out), _mm256_mul_ps(AVX2_FLOATS(low), gain0)));
+        _mm256_storeu_ps(out + 8, _mm256_add_ps(_mm256_loadu_ps(out + 8), _mm256_mul_ps(AVX2_FLOATS(high), gain1)));
+        gain0 = _mm256_add_ps(gain0, step8);
+        gain1 = _mm256_add_ps(gain1, step8);
+    }
+    mixFloatScalar(accumulator + 2 * i, source + 2 * i, frames - i, advance(gain, i));
+}
+
+__attribute__((target("avx2")))
+static void mixInt16Avx2(Sint16 *destination, const Sint16 *source, int frames, float left, float right)
+{
+    __m256 gain = _mm256_setr_ps(left, right, left, right, left, right, left, right);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i low = _mm_loadu_si128((const __m128i *)(source + 2 * i));
+        __m128i high = _mm_loadu_si128((const __m128i *)(source + 2 * i + 8));
+        __m128i mixedLow = _mm_loadu_si128((const __m128i *)(destination + 2 * i));
+        __m128i mixedHigh = _mm_loadu_si128((const __m128i *)(destination + 2 * i + 8));
+        __m256i sumLow = _mm256_add_epi32(_mm256_cvtepi16_epi32(mixedLow), _mm256_cvtps_epi32(_mm256_mul_ps(AVX2_FLOATS(low), gain)));
+        __m256i sumHigh = _mm256_add_epi32(_mm256_cvtepi16_epi32(mixedHigh), _mm256_cvtps_epi32(_mm256_mul_ps(AVX2_FLOATS(high), gain)));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sumLow, sumHigh), 0xD8);
+        _mm256_storeu_si256((__m256i *)(destination + 2 * i), packed);
+    }
+    mixInt16Scalar(destination + 2 * i, source + 2 * i, frames - i, left, right);
+}
+
+__attribute__((target("avx2")))
+static void toFloatAvx2(float *destination, const Sint16 *source, int samples)
+{
+    int i = 0;
+    for (; i + 16 <= samples; i += 16)
+    {
+        _mm256_storeu_ps(destination + i, AVX2_FLOATS(_mm_loadu_si128((const __m128i *)(source + i))));
+        _mm256_storeu_ps(destination + i + 8, AVX2_FLOATS(_mm_loadu_si128((const __m128i *)(source + i + 8))));
+    }
+    toFloatScalar(destination + i, source + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void toInt16Avx2(Sint16 *destination, const float *source, int samples)
+{
+    __m256 lowest = _mm256_set1_ps(-32768.0f);
+    __m256 highest = _mm256_set1_ps(32767.0f);
+
+    int i = 0;
+    for (; i + 16 <= samples; i += 16)
+    {
+        __m256i low = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(source + i), lowest), highest));
+        __m256i high = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(source + i + 8), lowest), highest));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+        _mm256_storeu_si256((__m256i *)(destination + i), packed);
+    }
+    toInt16Scalar(destination + i, source + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void filterAvx2(const Sint16 *source, const float *coefficients, int samples, float sums[2])
+{
+    __m256 sum = _mm256_setzero_ps();
+    for (int i = 0; i < samples; i += 8)
+    {
+        __m256 values = AVX2_FLOATS(_mm_loadu_si128((const __m128i *)(source + i)));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(values, _mm256_loadu_ps(coefficients + i)));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+    sums[0] = lanes[0] + lanes[2];
+    sums[1] = lanes[1] + lanes[3];
+}
+
+static const MixKernels avx2Kernels = { "avx2", mixFloatAvx2, mixInt16Avx2, toFloatAvx2, toInt16Avx2, filterAvx2 };
+
+#endif
+
+#if defined(__ARM_NEON)
+
+// NEON kernels, four frames at a time
+
+// Rounds to the nearest integer, as lrintf() and the SSE2 and AVX2 conversions do;
+// vcvtq_s32_f32() truncates, and ARMv7 has no rounding conversion, so half a unit
+// with the sign of the value is added before truncating there
+static inline int32x4_t roundNeon(float32x4_t values)
+{
+#if defined(__ARM_FEATURE_DIRECTED_ROUNDING)
+    return vcvtnq_s32_f32(values);
+#else
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(values), vdupq_n_u32(0x80000000u));
+    float32x4_t half = vreinterpretq_f32_u32(vorrq_u32(sign, vreinterpretq_u32_f32(vdupq_n_f32(0.5f))));
+    return vcvtq_s32_f32(vaddq_f32(values, half));
+#endif
+}
+
+static void mixFloatNeon(float *accumulator, const Sint16 *source, int frames, StereoGain gain)
+{
+    float32x4_t step2 = { 2 * gain.leftStep, 2 * gain.rightStep, 2 * gain.leftStep, 2 * gain.rightStep };
+    float32x4_t step4 = vaddq_f32(step2, step2);
+    float32x4_t gain0 = { gain.left, gain.right, gain.left + gain.leftStep, gain.right + gain.rightStep };
+    float32x4_t gain1 = vaddq_f32(gain0, step2);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        int16x8_t samples = vld1q_s16(source + 2 * i);
+        float32x4_t low = vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples)));
+        float32x4_t high = vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples)));
+        float *out = accumulator + 2 * i;
+        vst1q_f32(out, vmlaq_f32(vld1q_f32(out), low, gain0));
+        vst1q_f32(out + 4, vmlaq_f32(vld1q_f32(out + 4), high, gain1));
+        gain0 = vaddq_f32(gain0, step4);
+        gain1 = vaddq_f32(gain1, step4);
+    }
+    mixFloatScalar(accumulator + 2 * i, source + 2 * i, frames - i, advance(gain, i));
+}
+
+static void mixInt16Neon(Sint16 *destination, const Sint16 *source, int frames, float left, float right)
+{
+    float32x4_t gain = { left, right, left, right };
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        int16x8_t samples = vld1q_s16(source + 2 * i);
+        int16x8_t mixed = vld1q_s16(destination + 2 * i);
+        int32x4_t low = roundNeon(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples))), gain));
+        int32x4_t high = roundNeon(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples))), gain));
+        low = vaddw_s16(low, vget_low_s16(mixed));
+        high = vaddw_s16(high, vget_high_s16(mixed));
+        vst1q_s16(destination + 2 * i, vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+    }
+    mixInt16Scalar(destination + 2 * i, source + 2 * i, frames - i, left, right);
+}
+
+static void toFloatNeon(float *destination, const Sint16 *source, int samples)
+{
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        int16x8_t values = vld1q_s16(source + i);
+        vst1q_f32(destination + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(values))));
+        vst1q_f32(destination + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(values))));
+    }
+    toFloatScalar(destination + i, source + i, samples - i);
+}
+
+static void toInt16Neon(Sint16 *destination, const float *source, int samples)
+{
+    // Float to int conversion and narrowing both saturate
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        int32x4_t low = roundNeon(vld1q_f32(source + i));
+        int32x4_t high = roundNeon(vld1q_f32(source + i + 4));
+        vst1q_s16(destination + i, vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+    }
+    toInt16Scalar(destination + i, source + i, samples - i);
+}
+
+static void filterNeon(const Sint16 *source, const float *coefficients, int samples, float sums[2])
+{
+    float32x4_t low = vdupq_n_f32(0.0f);
+    float32x4_t high = vdupq_n_f32(0.0f);
+    for (int i = 0; i < samples; i += 8)
+    {
+        int16x8_t values = vld1q_s16(source + i);
+        low = vmlaq_f32(low, vcvtq_f32_s32(vmovl_s16(vget_low_s16(values))), vld1q_f32(coefficients + i));
+        high = vmlaq_f32(high, vcvtq_f32_s32(vmovl_s16(vget_high_s16(values))), vld1q_f32(coefficients + i + 4));
+    }
+
+    float32x4_t sum = vaddq_f32(low, high);
+    sums[0] = vgetq_lane_f32(sum, 0) + vgetq_lane_f32(sum, 2);
+    sums[1] = vgetq_lane_f32(sum, 1) + vgetq_lane_f32(sum, 3);
+}
+
+static const MixKernels neonKernels = { "neon", mixFloatNeon, mixInt16Neon, toFloatNeon, toInt16Neon, filterNeon };
+
+#endif
+
+std::vector<const MixKernels *> SupportedMixKernels(void)
+{
+    std::vector<const MixKernels *> kernels;
+    kernels.push_back(&scalarKernels);
+#ifdef MIXKERNEL_X86
+    if (SDL_HasSSE2())
+    {
+        kernels.push_back(&sse2Kernels);
+    }
+    if (SDL_HasAVX2())
+    {
+        kernels.push_back(&avx2Kernels);
+    }
+#endif
+#if defined(__ARM_NEON)
+    if (SDL_HasNEON())
+    {
+        kernels.push_back(&neonKernels);
+    }
+#endif
+    return kernels;
+}
+
+const MixKernels &BestMixKernels(void)
+{
+    static const MixKernels *best = SupportedMixKernels().back();
+    return *best;
+}
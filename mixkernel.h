@@ -0,0 +1,46 @@
+#ifndef MIXKERNEL_H
+#define MIXKERNEL_H
+
+#include <vector>
+
+#include "SDL.h"
+
+// Gain of a stereo voice, changing linearly by the given steps every frame
+struct StereoGain
+{
+    float left;
+    float right;
+    float leftStep;
+    float rightStep;
+};
+
+// Mixing kernels for interleaved stereo 16 bit audio. Float accumulators keep the
+// 16 bit scale, so nothing is rescaled until the final saturating conversion.
+struct MixKernels
+{
+    const char *name;
+
+    // Adds a voice to a float accumulator
+    void (*mixFloat)(float *accumulator, const Sint16 *source, int frames, StereoGain gain);
+
+    // Adds a voice to 16 bit samples, saturating after every voice
+    void (*mixInt16)(Sint16 *destination, const Sint16 *source, int frames, float left, float right);
+
+    // Converts samples to the float accumulator scale
+    void (*toFloat)(float *destination, const Sint16 *source, int samples);
+
+    // Converts an accumulator back to 16 bit samples, saturating
+    void (*toInt16)(Sint16 *destination, const float *source, int samples);
+
+    // Multiplies samples by coefficients and sums the products at even and at odd
+    // positions separately, the two channels of interleaved stereo; samples is a multiple of 8
+    void (*filter)(const Sint16 *source, const float *coefficients, int samples, float sums[2]);
+};
+
+// Kernel sets this CPU supports, from the plain C ones to the fastest
+std::vector<const MixKernels *> SupportedMixKernels(void);
+
+// The fastest kernel set this CPU supports
+const MixKernels &BestMixKernels(void);
+
+#endif
@@ -1,12 +1,15 @@
 #include <argp.h>                    // For argument parsing
+#include <ctype.h>
 #include <limits.h>
 #include <signal.h>                  // For signal handling
 #include <stdio.h>                   // For standard input/output functions
 #include <stdint.h>
 #include <stdlib.h>
 #include <sysexits.h>                // For standard exit codes
+#include <time.h>                    // For the wall clock of scheduled commands
 #include <unistd.h>                  // For POSIX API (e.g., getpid)
 
+#include <atomic>
 #include <vector>
 #include <iostream>
 #include <string>
@@ -14,33 +17,67 @@
 
 #include <mosquitto.h>               // For MQTT client functionality
 
-#include "rapidjson/document.h"      // For JSON parsing
-#include "rapidjson/writer.h"
+#include "rapidjson/writer.h"        // For JSON status reports
 #include "rapidjson/stringbuffer.h"
 
 #include "SDL.h"                     // For SDL library functions
 #include "SDL_mixer.h"               // For SDL audio mixing functions
 
 #include "alsautil.h"                // For ALSA utility functions
+#include "command.h"                 // For decoding JSON commands
+#include "commandqueue.h"            // For handing commands to the executor thread
+#include "gainramp.h"                // For volume ramps
+#include "mixerclock.h"              // For scheduling commands on a mixer frame
+#include "mqttaudio.h"               // For internals shared with mqttaudio-bench
+#include "pcmcache.h"                // For caching converted samples on disk
+#include "resampler.h"               // For converting samples to the output rate
 #include "sample.h"                  // For handling audio samples
 #include "samplemanager.h"           // For managing audio samples
+#include "topicrouter.h"             // For topic-routed commands
+#include "voicemixer.h"              // For the in-house mixer
 #include "SDL_rwhttp.h"              // For HTTP support in SDL
 
 using namespace std;
 using namespace rapidjson;
 
 // Function prototypes
-void setChannelVolume(int channel, float volume);
+void setChannelVolume(int channel, float volume, int ms, RampCurve curve, int delay);
 void pauseChannel(int channel);
 void resumeChannel(int channel);
-bool processCommand(Document &d);
+void haltAllVoices(bool alsoStopBgm);
+const CommandSpec *prepareCommand(Command &command);
+void publishStatus(const char *report, bool print);
+void reportLatency(void);
 
 const char *argp_program_version = "0.1.2";
 const char *argp_program_bug_address = "contact@mindgeist.com";
 
+// Voice a play on any free voice takes over when all of them are busy and the pool
+// cannot grow; voices of a higher priority than the play's are never taken over
+enum VoiceStealing
+{
+    STEAL_NONE,                                // Drop the play
+    STEAL_PRIORITY,                            // Lowest priority, the oldest of those
+    STEAL_OLDEST,                              // Started longest ago
+    STEAL_QUIETEST                             // Lowest volume, voices fading out first
+};
+
 // Global variables
 int frequency = 44100;                         // Audio frequency in Hz
+int mixingChannels = 0;                        // Number of voices, 0 for the mixer's default
+int maxVoices = 0;                             // Voices the pool may grow to, 0 for four times its initial size
+VoiceStealing voiceStealing = STEAL_PRIORITY;  // Which voice a play takes over when none is free
+std::string mixerBackend = "sdl";              // Mixer voices play on: sdl, simd or simd16
+VoiceMixer *voiceMixer = NULL;                 // In-house mixer, NULL when voices are SDL_mixer channels
+int mixerPeriod = 512;                         // Frames SDL_mixer mixes per callback
+bool tunePeriod = false;                       // Whether to use the lowest period that plays without xruns
+std::string periodFile = "";                   // File the tuned period of each device is kept in
+SDL_AudioDeviceID mixerDevice = 0;             // Audio device opened by SDL_mixer, 0 until it is open
+const int maxAudioDevices = 16;                // Ids SDL 2 hands out to open audio devices, its table of open devices has 16 slots
+MixerClock mixerClock;                         // Frames mixed so far, for scheduled commands
 float masterVolume = 1.0f;                     // Master volume (0.0 to 1.0)
+GainRamp masterGain;                           // Master volume as applied to the mixed output, changed with the mixer locked
+const int masterSmoothingMs = 10;              // Time a master volume change without one ramps over, so it does not click
 std::unordered_map<int, float> channelVolumes; // Map of volumes per channel
 
 std::string server = "localhost";              // MQTT server address
@@ -49,12 +86,176 @@ std::string topic = "";                        // MQTT topic to subscribe to
 std::string alsaDevice = "";                   // ALSA PCM device to use
 std::string uriprefix = "";                    // Prefix for audio file URIs
 
+std::string pcmCacheDir = "";                  // Directory for converted samples, if enabled
+std::string statusTopic = "";                  // MQTT topic status reports are published to, if any
+std::string routeBase = "";                    // Base topic of topic-routed commands, if enabled
+
 vector<string> preloads;                       // List of samples to preload
+int loadThreads = 2;                           // Number of background sample loader threads
+int loadDeadline = 5000;                       // Max. time in ms a play waits for its sample to load
+int streamPreroll = 64 * 1024;                 // Bytes buffered before a streamed play starts
+int cacheBudget = 0;                           // Max. MB of decoded samples kept in memory, 0 if unlimited
+ResampleQuality resampleQuality = RESAMPLE_MEDIUM; // How samples are converted to the output rate
+int resampleThreads = 0;                       // Threads a long sample is resampled on, 0 for one per core
 
 bool run = true;                               // Main loop control flag
+StageRecorder stageRecorder = NULL;            // Receives stage timings when benchmarking
 bool verbose = false;                          // Verbose output flag
 
 SampleManager manager(verbose);                // Sample manager instance
+struct mosquitto *mqttClient = NULL;           // Connected MQTT client, used for status reports
+
+// Commands that can be sent as a bare payload to a topic below the route base,
+// with the channel as the last topic level
+enum Route
+{
+    ROUTE_NONE = -1,
+    ROUTE_PLAY,                                // <base>/play/<channel>, payload is the file
+    ROUTE_VOLUME,                              // <base>/volume/<channel>, payload is the volume
+    ROUTE_FADE_OUT                             // <base>/fadeout/<channel>, payload is the time in ms
+};
+
+struct RouteSpec
+{
+    const char *pattern;                       // Topic below the route base
+    const char *command;                       // Command it is dispatched as
+    unsigned field;                            // Command field the payload goes to
+};
+
+static const RouteSpec routeSpecs[] =
+{
+    { "play/+", "play", FIELD_FILE },
+    { "volume/+", "soundSetVolume", FIELD_VOLUME },
+    { "fadeout/+", "fadeout", FIELD_TIME },
+};
+
+TopicRouter router;                            // Routes topics below the route base, built at startup
+
+// A command received from MQTT, waiting to be parsed and executed.
+// Slots are reused, so the payload buffer stops allocating once it has grown to fit.
+struct QueuedCommand
+{
+    std::string payload;                       // Raw payload, exactly payloadlen bytes
+    int route;                                 // Route the command arrived on, ROUTE_NONE for JSON or binary
+    int channel;                               // Channel taken from the topic of a routed command
+    Uint64 received;                           // Performance counter at arrival, which delays count from
+};
+
+CommandQueue<QueuedCommand, 256> commandQueue; // Commands waiting for the executor thread
+SDL_sem *executorWakeup = NULL;                // Posted whenever work is queued for the executor
+SDL_Thread *executorThread = NULL;             // Thread that owns all Mix_* calls
+std::atomic<bool> executorRunning(false);      // Executor loop control flag
+
+// A play command whose sample is still being loaded in the background
+struct PendingPlay
+{
+    Sample *sample;
+    int channel;
+    bool loop;
+    float volume;
+    bool exclusive;
+    int maxPlayLength;
+    int fadeIn;                                // Time in ms the play fades in over, 0 for none
+    RampCurve curve;                           // Shape of the fade in
+    float pan;                                 // -1.0 for left only to 1.0 for right only
+    int priority;
+    int id;                                    // Controller's reference of the play, -1 if none
+    int bus;                                   // Bus the play starts on, -1 if none
+    bool keepBgm;                              // Whether an exclusive play spares the background music bus
+    uint64_t startFrame;                       // Mixer frame to start at, 0 to start once the sample is ready
+    unsigned group;                            // Batch whose plays only start together, once all are ready; 0 if none
+    Uint32 deadline;                           // SDL_GetTicks() value after which the play is dropped
+};
+
+vector<PendingPlay> pendingPlays;              // Plays waiting for their sample or start frame, owned by the executor
+unsigned batchGroups = 0;                      // Groups handed out to the plays of batches so far
+vector<std::atomic<Sample *>> voiceSamples;   // Sample each channel plays, released when it finishes
+
+// The play a voice was last started with, for picking a voice to steal
+struct VoiceInfo
+{
+    bool allocated;                            // Started on any free voice, so it may be stolen
+    int priority;
+    int id;                                    // Controller's reference of the play, -1 if none
+    uint64_t started;                          // Order voices were started in
+    int bus = -1;                              // Bus the voice plays on, -1 if none or once it finishes
+    float volume;                              // Volume of the voice before the gain of its bus
+    float gain;                                // Effective volume the voice was last set to
+};
+
+vector<VoiceInfo> voiceInfos;                  // Play of each voice, owned by the executor but for the bus a finished voice leaves
+uint64_t voicesStarted = 0;                    // Voices started so far
+
+// A named group of voices, whose volume, fades, pauses and stops apply to all of its
+// voices in the same mixing period; a bus is created when a command first names it
+struct Bus
+{
+    std::string name;
+    float volume;                              // Gain of every voice on the bus (0.0 to 1.0)
+    bool paused;                               // Whether voices started on the bus start paused
+};
+
+#define MAX_BUSES 64                           // Buses beyond which commands naming new ones are rejected
+const int bgmBus = 0;                          // Bus of plays flagged 'bgm', spared by stopAll(false)
+vector<Bus> buses = { { "bgm", 1.0f, false } };  // Buses by index, owned by the executor
+
+// Commands are carried out this many frames ahead of the frame they are scheduled for,
+// which leaves the executor a full mixing period to wake up in time; set with the period
+int scheduleWindow = 2 * mixerPeriod;
+
+// Silence a scheduled voice starts with, so it sounds from its exact start frame
+// even though SDL_mixer starts channels at the beginning of a mixing period
+struct VoiceDelay
+{
+    std::vector<Uint8> line;                   // Delay line, scheduleWindow frames
+    int length;                                // Bytes of the line in use
+    int position;
+    Sint64 remaining;                          // Bytes of the voice still to come out of the line, -1 if it loops
+};
+
+vector<VoiceDelay> voiceDelays;                // Start delay of each SDL_mixer channel, used by voiceDelayEffect
+
+// Volume ramp of an SDL_mixer channel. SDL_mixer only steps a channel's volume once per
+// mixing period, so while a ramp is in place the channel's own volume stays at its
+// maximum and voiceRampEffect applies the ramp frame by frame instead.
+struct VoiceRamp
+{
+    GainRamp gain;
+    bool active;                               // Whether voiceRampEffect is registered on the channel
+    bool fading;                               // Whether the ramp is a scheduled fade out, which expires the channel once it has run
+};
+
+vector<VoiceRamp> voiceRamps;                  // Volume ramp of each SDL_mixer channel, changed with the mixer locked
+
+// A fade or volume change scheduled for a later mixing period; only the numeric fields
+// of the command are kept, its strings point into a payload that is long gone
+struct ScheduledCommand
+{
+    Command command;
+    CommandHandler handler;
+};
+
+#define MAX_SCHEDULED_COMMANDS 256             // Scheduled commands beyond which new ones are rejected
+vector<ScheduledCommand> scheduledCommands;    // Commands waiting for their start frame, owned by the executor
+
+// A streamed play whose stream is being opened on its own thread
+struct StreamPlay
+{
+    std::string uri;
+    bool loop;
+    float volume;
+    bool bgm;                                  // Whether it plays on the background music bus
+    unsigned generation;                       // Value of streamGeneration when the play was requested
+    Mix_Music *music;
+};
+
+SDL_mutex *streamLock = NULL;                  // Guards openedStream and streamGeneration
+StreamPlay *openedStream = NULL;               // Stream ready to start, handed over to the executor
+unsigned streamGeneration = 0;                 // Bumped whenever streams still being opened become stale
+Mix_Music *currentStream = NULL;               // Stream playing on the music channel
+float streamVolume = 1.0f;                     // Sample volume of the current stream
+bool currentStreamBgm = false;                 // Whether the current stream plays on the background music bus
+bool requestedStreamBgm = false;               // Whether the last stream requested plays on the background music bus
 
 // Signal handler to stop the main loop
 void handle_signal(int s)
@@ -62,6 +263,19 @@ void handle_signal(int s)
     run = false;
 }
 
+// Subscribes to the command topic and the routed command topics
+void subscribeTopics(struct mosquitto *mosq)
+{
+    mosquitto_subscribe(mosq, NULL, topic.c_str(), 0);
+    if (!routeBase.empty())
+    {
+        for (const auto &spec : routeSpecs)
+        {
+            mosquitto_subscribe(mosq, NULL, (routeBase + "/" + spec.pattern).c_str(), 0);
+        }
+    }
+}
+
 // MQTT connection callback function
 void connect_callback(struct mosquitto *mosq, void *obj, int result)
 {
@@ -69,7 +283,8 @@ void connect_callback(struct mosquitto *mosq, void *obj, int result)
     {
     case 0:
         printf("Connected successfully.\n");
-        mosquitto_subscribe(mosq, NULL, topic.c_str(), 0);
+        subscribeTopics(mosq);
+        reportLatency();
         return;
     case 1:
         fprintf(stderr, "Connection refused - unacceptable protocol version.\n");
@@ -87,6 +302,66 @@ void connect_callback(struct mosquitto *mosq, void *obj, int result)
     exit(EX_PROTOCOL);
 }
 
+// Drops pending plays for the given channel, or for all channels if channel is -1, that
+// would start before the given mixer frame; plays not scheduled for a frame always qualify
+void cancelPendingPlays(int channel, uint64_t until)
+{
+    for (auto it = pendingPlays.begin(); it != pendingPlays.end();)
+    {
+        if ((channel == -1 || it->channel == channel) && it->startFrame < until)
+        {
+            if (verbose)
+            {
+                printf("Cancelled pending play of '%s' on channel %d.\n", it->sample->sourceUri.c_str(), it->channel);
+            }
+            manager.Release(it->sample);
+            it = pendingPlays.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Drops pending plays on the given bus, or on any but the given bus if 'others' is set,
+// that would start before the given mixer frame
+void cancelBusPlays(int bus, bool others, uint64_t until)
+{
+    for (auto it = pendingPlays.begin(); it != pendingPlays.end();)
+    {
+        if ((it->bus == bus) != others && it->startFrame < until)
+        {
+            if (verbose)
+            {
+                printf("Cancelled pending play of '%s' on channel %d.\n", it->sample->sourceUri.c_str(), it->channel);
+            }
+            manager.Release(it->sample);
+            it = pendingPlays.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Drops streams that are still being opened or waiting to start
+void cancelStreams(void)
+{
+    SDL_LockMutex(streamLock);
+    ++streamGeneration;
+    StreamPlay *play = openedStream;
+    openedStream = NULL;
+    SDL_UnlockMutex(streamLock);
+
+    if (play != NULL)
+    {
+        Mix_FreeMusic(play->music);
+        delete play;
+    }
+}
+
 // Function to stop all sounds
 void stopAll(bool alsoStopBgm)
 {
@@ -95,349 +370,2077 @@ void stopAll(bool alsoStopBgm)
         printf("Stopping all sounds, %s background music.\n", alsoStopBgm ? "including" : "excluding");
     }
 
-    Mix_HaltChannel(-1); // Stop all channels
+    if (alsoStopBgm)
+    {
+        cancelPendingPlays(-1, UINT64_MAX);
+    }
+    else
+    {
+        cancelBusPlays(bgmBus, true, UINT64_MAX);
+    }
+    haltAllVoices(alsoStopBgm);
+
+    // The streamed play, and the one being opened, are spared like the voices on the background music bus
+    if (alsoStopBgm || !requestedStreamBgm)
+    {
+        cancelStreams();
+    }
+    if (alsoStopBgm || !currentStreamBgm)
+    {
+        Mix_HaltMusic();
+    }
 }
 
-// Function to preload an audio sample
-Sample *precacheSample(const char *file)
+// Prepends the URI prefix to a sound file location
+std::string resolveUri(const char *file)
 {
     std::string filename = file;
     if (uriprefix.length() > 0)
     {
         filename = uriprefix + filename;
     }
+    return filename;
+}
+
+// Function to preload an audio sample; the sample is loaded in the background
+Sample *precacheSample(const char *file)
+{
+    std::string filename = resolveUri(file);
     if (verbose)
     {
         printf("Preloading sample '%s'\n", filename.c_str());
     }
-    return manager.GetSample(filename.c_str());
+    return manager.RequestSample(filename.c_str());
 }
 
-// Function to play an audio sample with specified parameters
-void playSample(const char *file, int channel, bool loop, float volume, bool exclusive, bool isBgm, int maxPlayLength, bool nocache)
+// Called by SDL_mixer when a channel stops playing, on the audio thread or on the
+// thread that halted it, with the mixer locked either way; drops the voice's reference
+// to its sample and takes it off its bus, so bus commands leave the idle channel alone
+void channelFinished(int channel)
 {
-    // Limit the sample volume between 0.0 and 1.0
-    if (volume < 0.0f) volume = 0.0f;
-    if (volume > 1.0f) volume = 1.0f;
+    Sample *sample = voiceSamples[channel].exchange(NULL);
+    if (sample != NULL)
+    {
+        manager.Release(sample);
+    }
+    voiceInfos[channel].bus = -1;
 
-    // Get the channel volume or set it to 1.0 if it doesn't exist
-    float channelVolume = 1.0f;
-    auto it = channelVolumes.find(channel);
-    if (it != channelVolumes.end())
+    // SDL_mixer drops the channel's effects along with it
+    if (channel < (int)voiceRamps.size())
     {
-        channelVolume = it->second;
+        voiceRamps[channel].active = false;
     }
-    else
+}
+
+// Locks the mixer, so the mixer clock stands still and voices started until it is
+// unlocked all start in the same mixing period
+void lockMixer(void)
+{
+    SDL_LockAudioDevice(mixerDevice);
+}
+
+void unlockMixer(void)
+{
+    SDL_UnlockAudioDevice(mixerDevice);
+}
+
+// SDL_mixer post-mix callback, called on the audio thread after every mixing period
+void postMix(void *data, Uint8 *stream, int length)
+{
+    int frameBytes = mixerClock.FrameBytes();
+    if (voiceMixer != NULL)
     {
-        channelVolumes[channel] = channelVolume; // Initialize to 1.0
+        voiceMixer->Mix((Sint16 *)stream, length / frameBytes);
     }
 
-    // Calculate the effective volume
-    float effectiveVolume = volume * channelVolume * masterVolume;
-    if (effectiveVolume < 0.0f) effectiveVolume = 0.0f;
-    if (effectiveVolume > 1.0f) effectiveVolume = 1.0f;
+    // The master volume applies once to everything mixed, voices and streamed play alike
+    masterGain.Apply((Sint16 *)stream, length / frameBytes, frameBytes / sizeof(Sint16));
+    mixerClock.Mixed(length);
+}
 
-    int sdlVolume = static_cast<int>(effectiveVolume * MIX_MAX_VOLUME);
+// Voice operations, on SDL_mixer's channels or on the in-house mixer; a channel of -1
+// stands for all of them
 
-    if (verbose)
+void haltVoice(int channel)
+{
+    if (voiceMixer != NULL)
+    {
+        lockMixer();
+        voiceMixer->Halt(channel);
+        unlockMixer();
+    }
+    else
     {
-        printf("Playing sound %s, on channel %d, %s, at effective volume %.2f (sample volume: %.2f, channel volume: %.2f, master volume: %.2f)\n",
-               file, channel, loop ? "looping" : "once", effectiveVolume, volume, channelVolume, masterVolume);
+        Mix_HaltChannel(channel);
     }
+}
 
-    // Handle the nocache parameter
-    if (nocache)
+void setVoiceVolume(int channel, float volume)
+{
+    for (int i = 0; i < (int)voiceInfos.size(); i++)
     {
-        manager.RemoveSample(file);
-        if (verbose)
+        if (channel == -1 || channel == i)
         {
-            printf("Removed sample '%s' from cache due to nocache=true.\n", file);
+            voiceInfos[i].gain = volume;
         }
     }
 
-    if (exclusive)
+    lockMixer();
+    if (voiceMixer != NULL)
     {
-        Mix_HaltChannel(-1); // Stop all channels if exclusive
+        voiceMixer->SetVolume(channel, volume);
     }
-
-    Sample *sample = precacheSample(file); // Preload the sample
-    if (sample != NULL)
+    else
     {
-        Mix_Volume(channel, sdlVolume); // Adjust the volume before playing
-        Mix_PlayChannelTimed(channel, sample->chunk, loop ? -1 : 0, maxPlayLength); // Play on the selected channel
+        Mix_Volume(channel, static_cast<int>(volume * MIX_MAX_VOLUME));
+        for (int i = 0; i < (int)voiceRamps.size(); i++)
+        {
+            if ((channel == -1 || channel == i) && voiceRamps[i].active)
+            {
+                // A scheduled fade out carries on, as SDL_mixer's own fades do
+                Mix_Volume(i, MIX_MAX_VOLUME);
+                if (!voiceRamps[i].fading)
+                {
+                    voiceRamps[i].gain.Set(volume);
+                }
+            }
+        }
     }
-    else
+    unlockMixer();
+}
+
+// Channel effect that applies a channel's volume ramp; SDL_mixer removes it when the channel
+// finishes. A channel whose scheduled fade out has run is silent, and is expired.
+void voiceRampEffect(int channel, void *stream, int length, void *data)
+{
+    VoiceRamp *ramp = (VoiceRamp *)data;
+    int frameBytes = mixerClock.FrameBytes();
+    ramp->gain.Apply((Sint16 *)stream, length / frameBytes, frameBytes / sizeof(Sint16));
+    if (ramp->fading && !ramp->gain.Ramping())
     {
-        printf("Error - could not load requested sample '%s'\n", file);
+        Mix_ExpireChannel(channel, 1);
     }
 }
 
-// Function to process incoming MQTT commands
-bool processCommand(Document &d)
+// Puts an SDL_mixer channel's volume under its ramp, starting from the volume it has;
+// must be called with the mixer locked
+void startVoiceRamp(int channel)
 {
-    if (!d.IsObject())
+    VoiceRamp &ramp = voiceRamps[channel];
+    if (!ramp.active)
     {
-        fprintf(stderr, "Message is not a valid object.\n");
-        return false;
+        ramp.gain.Set((float)Mix_Volume(channel, MIX_MAX_VOLUME) / MIX_MAX_VOLUME);
+        Mix_RegisterEffect(channel, voiceRampEffect, NULL, &ramp);
+        ramp.active = true;
+        ramp.fading = false;
     }
+}
 
-    if (!d.HasMember("command") || !d["command"].IsString())
+// Moves a voice's volume to a new one over ms along a curve, starting delay frames from
+// the next frame mixed
+void rampVoiceVolume(int channel, float volume, int ms, RampCurve curve, int delay)
+{
+    if (ms <= 0 && delay == 0)
     {
-        fprintf(stderr, "Message does not have a 'command' property that is a string.\n");
-        return false;
+        setVoiceVolume(channel, volume);
+        return;
     }
 
-    const char *command = d["command"].GetString();
-    if (0 == strcasecmp(command, "soundPlay") || 0 == strcasecmp(command, "play"))
+    for (int i = 0; i < (int)voiceInfos.size(); i++)
     {
-        // Verify that the message has all required parameters
-        if (!d.HasMember("message") || !d["message"].IsObject())
+        if (channel == -1 || channel == i)
         {
-            fprintf(stderr, "Message does not have a 'message' property that is an object.\n");
-            return false;
+            voiceInfos[i].gain = volume;
         }
+    }
 
-        if (!d["message"].HasMember("file") || !d["message"]["file"].IsString())
+    lockMixer();
+    if (voiceMixer != NULL)
+    {
+        voiceMixer->Ramp(channel, volume, ms, curve, delay);
+    }
+    else
+    {
+        int frames = (int)((Sint64)ms * mixerClock.Frequency() / 1000);
+        for (int i = 0; i < mixingChannels; i++)
         {
-            fprintf(stderr, "Message does not have a 'file' property that is a string.\n");
-            return false;
-        }
-
-        const char *file = d["message"]["file"].GetString();
-        int channel = 0; // Default channel
-        bool loop = false;
-        float volume = 1.0f;
-        bool exclusive = false;
-        bool bgm = false;
-        bool nocache = false; // Default for nocache
-        int maxPlayLength = -1;
+            if (channel != -1 && channel != i)
+            {
+                continue;
+            }
 
-        // Adjust parameters based on the message
-        if (d["message"].HasMember("channel") && d["message"]["channel"].IsInt())
-        {
-            channel = d["message"]["channel"].GetInt();
+            // A silent channel has nothing to ramp, and would keep the effect until it next finishes;
+            // a scheduled fade out carries on, as SDL_mixer's own fades do
+            if (Mix_Playing(i))
+            {
+                startVoiceRamp(i);
+                if (!voiceRamps[i].fading)
+                {
+                    voiceRamps[i].gain.Start(volume, frames, curve, delay);
+                }
+            }
+            else
+            {
+                Mix_Volume(i, static_cast<int>(volume * MIX_MAX_VOLUME));
+            }
         }
+    }
+    unlockMixer();
+}
 
-        if (d["message"].HasMember("loop") && d["message"]["loop"].IsBool())
+// Fades a voice out over ms, starting delay frames from the next frame mixed; a fade of
+// no length halts it then
+void fadeOutVoice(int channel, int ms, int delay)
+{
+    lockMixer();
+    if (voiceMixer != NULL)
+    {
+        voiceMixer->FadeOut(channel, ms, delay);
+    }
+    else if (delay == 0)
+    {
+        Mix_FadeOutChannel(channel, ms);
+    }
+    else
+    {
+        // SDL_mixer only starts fades with a mixing period, so a scheduled fade is a ramp to
+        // silence from its own frame, and voiceRampEffect expires the channel once it has run
+        int frames = (int)((Sint64)ms * mixerClock.Frequency() / 1000);
+        for (int i = 0; i < mixingChannels; i++)
         {
-            loop = d["message"]["loop"].GetBool();
+            if ((channel == -1 || channel == i) && Mix_Playing(i))
+            {
+                startVoiceRamp(i);
+                voiceRamps[i].gain.Start(0.0f, frames, CURVE_LINEAR, delay);
+                voiceRamps[i].fading = true;
+            }
         }
+    }
+    unlockMixer();
+}
 
-        if (d["message"].HasMember("volume") && d["message"]["volume"].IsFloat())
-        {
-            volume = d["message"]["volume"].GetFloat();
-        }
+void pauseVoice(int channel)
+{
+    if (voiceMixer != NULL)
+    {
+        lockMixer();
+        voiceMixer->Pause(channel);
+        unlockMixer();
+    }
+    else
+    {
+        Mix_Pause(channel);
+    }
+}
 
-        if (d["message"].HasMember("exclusive") && d["message"]["exclusive"].IsBool())
-        {
-            exclusive = d["message"]["exclusive"].GetBool();
-        }
+void resumeVoice(int channel)
+{
+    if (voiceMixer != NULL)
+    {
+        lockMixer();
+        voiceMixer->Resume(channel);
+        unlockMixer();
+    }
+    else
+    {
+        Mix_Resume(channel);
+    }
+}
 
-        if (d["message"].HasMember("bgm") && d["message"]["bgm"].IsBool())
-        {
-            bgm = d["message"]["bgm"].GetBool();
-        }
+bool voicePlaying(int channel)
+{
+    if (voiceMixer != NULL)
+    {
+        lockMixer();
+        bool playing = voiceMixer->Playing(channel);
+        unlockMixer();
+        return playing;
+    }
+    return Mix_Playing(channel) != 0;
+}
 
-        if (d["message"].HasMember("maxPlayLength") && d["message"]["maxPlayLength"].IsInt())
-        {
-            maxPlayLength = d["message"]["maxPlayLength"].GetInt();
-        }
+bool voiceFading(int channel)
+{
+    if (voiceMixer != NULL)
+    {
+        lockMixer();
+        bool fading = voiceMixer->Fading(channel);
+        unlockMixer();
+        return fading;
+    }
+    lockMixer();
+    bool fading = Mix_FadingChannel(channel) == MIX_FADING_OUT || (voiceRamps[channel].active && voiceRamps[channel].fading);
+    unlockMixer();
+    return fading;
+}
 
-        if (d["message"].HasMember("nocache") && d["message"]["nocache"].IsBool())
-        {
-            nocache = d["message"]["nocache"].GetBool();
-        }
+// Bus operations, on the voices last started on a bus; with the mixer locked, they all
+// take effect in the same mixing period, or on the same frame delay frames from the next
+// one mixed
 
-        playSample(file, channel, loop, volume, exclusive, bgm, maxPlayLength, nocache);
-        return true;
-    }
-    else if (0 == strcasecmp(command, "soundStopAll") || 0 == strcasecmp(command, "stopall"))
+// Halts every voice, or every voice but those on the background music bus
+void haltAllVoices(bool alsoStopBgm)
+{
+    if (alsoStopBgm)
     {
-        stopAll(true);
-        return true;
+        haltVoice(-1);
+        return;
     }
-    else if (0 == strcasecmp(command, "soundFadeOut") || 0 == strcasecmp(command, "fadeout"))
+
+    lockMixer();
+    for (int i = 0; i < mixingChannels; i++)
     {
-        if (d["message"].HasMember("time") && d["message"]["time"].IsInt())
+        if (voiceInfos[i].bus != bgmBus)
         {
-            int time = d["message"]["time"].GetInt();
-            int channel = -1; // Default to all channels
+            haltVoice(i);
+        }
+    }
+    unlockMixer();
+}
 
-            if (d["message"].HasMember("channel") && d["message"]["channel"].IsInt())
+void haltBus(int bus, int delay)
+{
+    lockMixer();
+    for (int i = 0; i < mixingChannels; i++)
+    {
+        if (voiceInfos[i].bus == bus)
+        {
+            if (delay > 0)
             {
-                channel = d["message"]["channel"].GetInt(); // Specific channel
+                fadeOutVoice(i, 0, delay);
             }
-
-            if (verbose)
+            else
             {
-                printf("Fading out channel %d for %d milliseconds.\n", channel, time);
+                haltVoice(i);
             }
+        }
+    }
+    unlockMixer();
+}
+
+void fadeOutBus(int bus, int ms, int delay)
+{
+    lockMixer();
+    for (int i = 0; i < mixingChannels; i++)
+    {
+        if (voiceInfos[i].bus == bus)
+        {
+            fadeOutVoice(i, ms, delay);
+        }
+    }
+    unlockMixer();
+}
+
+void setBusVolume(int bus, float volume, int ms, RampCurve curve, int delay)
+{
+    buses[bus].volume = volume;
+    lockMixer();
+    for (int i = 0; i < mixingChannels; i++)
+    {
+        if (voiceInfos[i].bus == bus)
+        {
+            rampVoiceVolume(i, voiceInfos[i].volume * volume, ms, curve, delay);
+        }
+    }
+    unlockMixer();
+}
 
-            // Apply fade out to specified channel or all channels
-            if (channel == -1)
+void pauseBus(int bus, bool paused)
+{
+    buses[bus].paused = paused;
+    lockMixer();
+    for (int i = 0; i < mixingChannels; i++)
+    {
+        if (voiceInfos[i].bus == bus)
+        {
+            if (paused)
             {
-                Mix_FadeOutChannel(-1, time); // Fade out all channels
+                pauseVoice(i);
             }
             else
             {
-                Mix_FadeOutChannel(channel, time); // Fade out specific channel
+                resumeVoice(i);
             }
         }
-        return true;
     }
-    else if (0 == strcasecmp(command, "soundPrecache") || 0 == strcasecmp(command, "precache"))
+    unlockMixer();
+}
+
+// Looks up a bus by name, creating it on first use if asked to; -1 if there is no such
+// bus, or no room for another
+int findBus(const char *name, bool create)
+{
+    for (int i = 0; i < (int)buses.size(); i++)
     {
-        if (!d.HasMember("message") || !d["message"].IsObject())
+        if (strcasecmp(buses[i].name.c_str(), name) == 0)
         {
-            fprintf(stderr, "Message does not have a 'message' property that is an object.\n");
-            return false;
+            return i;
         }
+    }
+    if (!create || buses.size() >= MAX_BUSES)
+    {
+        return -1;
+    }
+    buses.push_back({ name, 1.0f, false });
+    return (int)buses.size() - 1;
+}
 
-        if (!d["message"].HasMember("file") || !d["message"]["file"].IsString())
-        {
-            fprintf(stderr, "Message does not have a 'message.file' property that is a string.\n");
-            return false;
-        }
+// Whether a command scheduled for a mixer frame is due to be carried out
+bool frameDue(uint64_t frame)
+{
+    return frame < mixerClock.Frames() + scheduleWindow;
+}
+
+// Frames from the next frame mixed to a scheduled one, 0 if it is not scheduled or has
+// passed; must be called with the mixer locked, so the clock stands still until the
+// voices are told to wait them out
+int framesUntil(uint64_t frame)
+{
+    uint64_t frames = mixerClock.Frames();
+    return frame > frames ? (int)SDL_min(frame - frames, (uint64_t)scheduleWindow) : 0;
+}
 
-        const char *file = d["message"]["file"].GetString();
-        precacheSample(file);
+// Milliseconds until a command scheduled for a mixer frame is due
+Sint32 millisecondsUntilDue(uint64_t frame)
+{
+    return frame > (uint64_t)scheduleWindow ? mixerClock.MillisecondsUntil(frame - scheduleWindow) : 0;
+}
 
-        if (verbose)
+// Channel effect that delays a voice through its delay line; SDL_mixer removes it
+// when the channel finishes. A voice that ends plays its sample again, so the
+// channel keeps running while the end of the sample drains from the line, and is
+// silenced and expired once it has.
+void voiceDelayEffect(int channel, void *stream, int length, void *data)
+{
+    VoiceDelay *delay = (VoiceDelay *)data;
+    Uint8 *bytes = (Uint8 *)stream;
+    if (delay->remaining >= 0 && delay->remaining < length)
+    {
+        memset(bytes + delay->remaining, 0, length - delay->remaining);
+        length = (int)delay->remaining;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        Uint8 value = bytes[i];
+        bytes[i] = delay->line[delay->position];
+        delay->line[delay->position] = value;
+        if (++delay->position == delay->length)
         {
-            printf("Precached sound file '%s'.\n", file);
+            delay->position = 0;
         }
-        return true;
     }
-    else if (0 == strcasecmp(command, "soundSetVolume"))
+    if (delay->remaining > 0)
     {
-        if (!d.HasMember("message") || !d["message"].IsObject())
+        delay->remaining -= length;
+        if (delay->remaining == 0)
         {
-            fprintf(stderr, "Message does not have a 'message' property that is an object.\n");
-            return false;
+            Mix_ExpireChannel(channel, 1);
         }
+    }
+}
 
-        if (!d["message"].HasMember("channel") || !d["message"]["channel"].IsInt())
+// Grows the voice pool; the voices already playing carry on
+bool growVoices(int count)
+{
+    if (voiceMixer != NULL)
+    {
+        lockMixer();
+        voiceMixer->SetVoices(count);
+        unlockMixer();
+    }
+    else if (Mix_AllocateChannels(count) != count)
+    {
+        fprintf(stderr, "Unable to grow the voice pool to %d voices.\n", count);
+        return false;
+    }
+
+    if (verbose)
+    {
+        printf("Grew the voice pool from %d to %d voices.\n", mixingChannels, count);
+    }
+    mixingChannels = count;
+    return true;
+}
+
+// Publishes which voice a play started on or was stolen from, so controllers can
+// address it without tracking which voices are busy
+void reportVoice(const char *event, int channel, int id, const std::string &uri)
+{
+    StringBuffer buffer;
+    Writer<StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("event");
+    writer.String(event);
+    writer.Key("voice");
+    writer.Int(channel);
+    if (id != -1)
+    {
+        writer.Key("id");
+        writer.Int(id);
+    }
+    writer.Key("file");
+    writer.String(uri.c_str());
+    writer.EndObject();
+
+    publishStatus(buffer.GetString(), verbose);
+}
+
+// Whether voice a should be stolen before voice b, given the volumes they count with
+bool stealsBefore(const VoiceInfo &a, float gainA, const VoiceInfo &b, float gainB)
+{
+    if (voiceStealing == STEAL_PRIORITY && a.priority != b.priority)
+    {
+        return a.priority < b.priority;
+    }
+    if (voiceStealing == STEAL_QUIETEST && gainA != gainB)
+    {
+        return gainA < gainB;
+    }
+    return a.started < b.started;
+}
+
+// Whether a voice has been picked for a play of a batch that has not started yet
+bool voiceClaimed(int channel)
+{
+    return voiceSamples[channel] != NULL && !voicePlaying(channel);
+}
+
+// Picks the voice for a play on any free voice: an idle one, a new one while the pool
+// may grow, or one taken over according to the stealing policy; -1 if there is none
+int allocateVoice(const PendingPlay &play)
+{
+    lockMixer();
+    int channel = -1;
+    for (int i = 0; i < mixingChannels && channel == -1; i++)
+    {
+        if (!voicePlaying(i) && voiceSamples[i] == NULL)
+        {
+            channel = i;
+        }
+    }
+    unlockMixer();
+
+    if (channel != -1)
+    {
+        return channel;
+    }
+    if (mixingChannels < maxVoices)
+    {
+        channel = mixingChannels;
+        return growVoices(SDL_min(2 * mixingChannels, maxVoices)) ? channel : -1;
+    }
+    if (voiceStealing == STEAL_NONE)
+    {
+        return -1;
+    }
+
+    // Voices a controller put on a channel of its own are left alone
+    float victimGain = 0.0f;
+    for (int i = 0; i < mixingChannels; i++)
+    {
+        const VoiceInfo &info = voiceInfos[i];
+        if (!info.allocated || info.priority > play.priority || voiceClaimed(i))
+        {
+            continue;
+        }
+        float gain = voiceStealing == STEAL_QUIETEST && voiceFading(i) ? 0.0f : info.gain;
+        if (channel == -1 || stealsBefore(info, gain, voiceInfos[channel], victimGain))
+        {
+            channel = i;
+            victimGain = gain;
+        }
+    }
+
+    if (channel != -1)
+    {
+        lockMixer();
+        Sample *sample = voiceSamples[channel];
+        std::string uri = sample != NULL ? sample->sourceUri : "";
+        haltVoice(channel);
+        unlockMixer();
+        reportVoice("voiceStolen", channel, voiceInfos[channel].id, uri);
+    }
+    return channel;
+}
+
+// A play whose voice has been picked and recorded, waiting to be started with the mixer locked
+struct VoiceStart
+{
+    const PendingPlay *play;
+    int channel;
+    float effectiveVolume;
+    bool played;
+    std::string error;                         // Why the start failed, if it did
+};
+
+// Picks and records the voice of a play whose sample has finished loading; everything a
+// start needs that may block or take other locks is done here, so startVoice() only has
+// to make the mixer calls. Returns false if there is no voice for the play.
+bool prepareVoice(const PendingPlay &play, VoiceStart &start)
+{
+    if (play.exclusive)
+    {
+        haltAllVoices(!play.keepBgm); // Stop all channels if exclusive
+    }
+
+    // The channel must be idle before its voice is recorded, so that its finish
+    // callback can only ever release the sample it was started with
+    int channel = play.channel;
+    if (channel == -1)
+    {
+        channel = allocateVoice(play);
+        if (channel == -1)
+        {
+            fprintf(stderr, "Error - no voice to play sample '%s' on\n", play.sample->sourceUri.c_str());
+            return false;
+        }
+    }
+    else if (channel < 0 || channel >= maxVoices)
+    {
+        fprintf(stderr, "Error - invalid channel %d for sample '%s'\n", channel, play.sample->sourceUri.c_str());
+        return false;
+    }
+    else if (channel >= mixingChannels && !growVoices(channel + 1))
+    {
+        return false;
+    }
+    else
+    {
+        haltVoice(channel);
+    }
+
+    // Get the channel volume or set it to 1.0 if it doesn't exist
+    float channelVolume = 1.0f;
+    auto it = channelVolumes.find(channel);
+    if (it != channelVolumes.end())
+    {
+        channelVolume = it->second;
+    }
+    else
+    {
+        channelVolumes[channel] = channelVolume; // Initialize to 1.0
+    }
+
+    // Calculate the effective volume; the master volume applies to the mixed output
+    float volume = play.volume * channelVolume;
+    if (volume < 0.0f) volume = 0.0f;
+    if (volume > 1.0f) volume = 1.0f;
+    float busVolume = play.bus != -1 ? buses[play.bus].volume : 1.0f;
+    float effectiveVolume = volume * busVolume;
+
+    if (verbose)
+    {
+        printf("Playing sound %s, on channel %d, %s, at effective volume %.2f (sample volume: %.2f, channel volume: %.2f, bus volume: %.2f), under master volume %.2f\n",
+               play.sample->sourceUri.c_str(), channel, play.loop ? "looping" : "once", effectiveVolume, play.volume, channelVolume, busVolume, masterVolume);
+    }
+
+    manager.Retain(play.sample);
+    voiceSamples[channel] = play.sample;
+
+    VoiceInfo &info = voiceInfos[channel];
+    info.allocated = play.channel == -1;
+    info.priority = play.priority;
+    info.id = play.id;
+    info.started = ++voicesStarted;
+    info.bus = play.bus;
+    info.volume = volume;
+    info.gain = effectiveVolume;
+
+    start.play = &play;
+    start.channel = channel;
+    start.effectiveVolume = effectiveVolume;
+    start.played = false;
+    return true;
+}
+
+// Starts a prepared voice; must be called with the mixer locked
+void startVoice(VoiceStart &start)
+{
+    const PendingPlay &play = *start.play;
+    int channel = start.channel;
+    float effectiveVolume = start.effectiveVolume;
+
+    // Balance: the side panned away from is attenuated, the other one kept
+    float left = play.pan > 0.0f ? 1.0f - play.pan : 1.0f;
+    float right = play.pan < 0.0f ? 1.0f + play.pan : 1.0f;
+
+    // With the mixer locked, the channel starts exactly at the clock's frame count,
+    // so a scheduled voice is delayed by the rest of the way to its start frame
+    int delay = framesUntil(play.startFrame);
+    uint64_t frames = mixerClock.Frames();
+    if (verbose && play.startFrame != 0 && play.startFrame < frames)
+    {
+        printf("Scheduled play on channel %d starts %.1f ms late.\n", channel, (frames - play.startFrame) * 1000.0 / mixerClock.Frequency());
+    }
+    Uint64 playStart = stageRecorder != NULL ? SDL_GetPerformanceCounter() : 0;
+    bool played;
+    if (voiceMixer != NULL)
+    {
+        // The in-house mixer delays the voice itself, and its fade in along with it; it only
+        // runs on 16 bit stereo output, so samples converted to it are made of its frames
+        voiceMixer->SetVolume(channel, play.fadeIn > 0 ? 0.0f : effectiveVolume);
+        played = voiceMixer->Play(channel, (const Sint16 *)play.sample->chunk->abuf, play.sample->chunk->alen / mixerClock.FrameBytes(),
+                                  play.loop ? -1 : 0, play.maxPlayLength, delay);
+        if (played && play.pan != 0.0f)
+        {
+            voiceMixer->SetPanning(channel, left, right);
+        }
+        if (played && play.fadeIn > 0)
+        {
+            voiceMixer->Ramp(channel, effectiveVolume, play.fadeIn, play.curve, delay);
+        }
+    }
+    else
+    {
+        int loops = play.loop ? -1 : 0;
+        if (delay > 0)
+        {
+            VoiceDelay &voiceDelay = voiceDelays[channel];
+            voiceDelay.length = delay * mixerClock.FrameBytes();
+            voiceDelay.position = 0;
+            memset(voiceDelay.line.data(), 0, voiceDelay.length);
+            Mix_RegisterEffect(channel, voiceDelayEffect, NULL, &voiceDelay);
+
+            // The sample is repeated for at least as long as the delay, which feeds the
+            // line while its end comes out of it
+            Uint32 alen = play.sample->chunk->alen;
+            voiceDelay.remaining = play.loop ? -1 : (Sint64)alen + voiceDelay.length;
+            if (!play.loop && alen > 0)
+            {
+                loops = (voiceDelay.length + alen - 1) / alen;
+            }
+        }
+
+        // The ramp effect comes after the delay effect, like those of later volume changes,
+        // so every ramp counts frames of the output; a fade in holds silence until the voice starts
+        if (play.fadeIn > 0)
+        {
+            Mix_Volume(channel, 0);
+            startVoiceRamp(channel);
+            voiceRamps[channel].gain.Start(effectiveVolume, (int)((Sint64)play.fadeIn * mixerClock.Frequency() / 1000), play.curve, delay);
+        }
+        else
+        {
+            Mix_Volume(channel, static_cast<int>(effectiveVolume * MIX_MAX_VOLUME)); // Adjust the volume before playing
+        }
+
+        // The channel's play length runs from when it starts, so it covers the delay as well
+        int maxPlayLength = play.maxPlayLength;
+        if (maxPlayLength > 0 && delay > 0)
+        {
+            maxPlayLength += (int)(((Sint64)delay * 1000 + mixerClock.Frequency() - 1) / mixerClock.Frequency());
+        }
+        played = Mix_PlayChannelTimed(channel, play.sample->chunk, loops, maxPlayLength) >= 0; // Play on the selected channel
+        if (played && play.pan != 0.0f)
+        {
+            Mix_SetPanning(channel, (Uint8)(left * 255), (Uint8)(right * 255));
+        }
+        else if (!played)
+        {
+            Mix_UnregisterAllEffects(channel);
+            voiceRamps[channel].active = false;
+        }
+    }
+    if (stageRecorder != NULL)
+    {
+        stageRecorder(STAGE_PLAY, SDL_GetPerformanceCounter() - playStart);
+    }
+    if (played && play.bus != -1 && buses[play.bus].paused)
+    {
+        pauseVoice(channel);
+    }
+    start.played = played;
+    if (!played)
+    {
+        start.error = voiceMixer != NULL ? "the sample is empty" : Mix_GetError();
+    }
+}
+
+// Finishes a start once the mixer is unlocked: reports the voice, or drops it if it failed
+void finishVoice(const VoiceStart &start)
+{
+    const PendingPlay &play = *start.play;
+    if (!start.played)
+    {
+        fprintf(stderr, "Unable to play sample '%s': %s\n", play.sample->sourceUri.c_str(), start.error.c_str());
+        voiceSamples[start.channel] = NULL;
+        voiceInfos[start.channel].bus = -1;
+        manager.Release(play.sample);
+    }
+    else if (play.channel == -1)
+    {
+        reportVoice("voicePlaying", start.channel, play.id, play.sample->sourceUri);
+    }
+}
+
+// Starts a play whose sample has finished loading
+void startPlay(const PendingPlay &play)
+{
+    VoiceStart start;
+    if (!prepareVoice(play, start))
+    {
+        return;
+    }
+    lockMixer();
+    startVoice(start);
+    unlockMixer();
+    finishVoice(start);
+}
+
+// Starts plays whose samples have finished loading together, in the same mixing period:
+// all voices are prepared first, and only the calls that start them are made with the
+// mixer locked, so the audio thread is never held up by pool growth or status reports
+void startPlays(const std::vector<PendingPlay> &plays)
+{
+    std::vector<VoiceStart> starts;
+    starts.reserve(plays.size());
+    for (size_t i = 0; i < plays.size(); i++)
+    {
+        // A later play on the same channel would cut this one off as it starts
+        bool superseded = false;
+        for (size_t j = i + 1; j < plays.size() && !superseded; j++)
+        {
+            superseded = plays[i].channel != -1 && plays[j].channel == plays[i].channel;
+        }
+
+        VoiceStart start;
+        if (!superseded && prepareVoice(plays[i], start))
+        {
+            starts.push_back(start);
+        }
+    }
+
+    lockMixer();
+    for (auto &start : starts)
+    {
+        startVoice(start);
+    }
+    unlockMixer();
+
+    for (const auto &start : starts)
+    {
+        finishVoice(start);
+    }
+}
+
+// Whether a play of a batch's group is still waiting for its sample
+bool groupLoading(unsigned group)
+{
+    for (const auto &play : pendingPlays)
+    {
+        if (play.group == group && play.sample->isLoading())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Starts the pending plays of a batch's group whose samples are ready, all together;
+// the ones whose sample failed are left to be dropped
+void startGroup(unsigned group)
+{
+    std::vector<PendingPlay> plays;
+    for (auto it = pendingPlays.begin(); it != pendingPlays.end();)
+    {
+        if (it->group == group && it->sample->isValid())
+        {
+            plays.push_back(*it);
+            it = pendingPlays.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    startPlays(plays);
+    for (const auto &play : plays)
+    {
+        manager.Release(play.sample);
+    }
+}
+
+// Starts pending plays whose samples are ready and drops failed or expired ones; the
+// plays of a batch wait until all of them are ready
+void servicePendingPlays(void)
+{
+    Uint32 now = SDL_GetTicks();
+    for (auto it = pendingPlays.begin(); it != pendingPlays.end();)
+    {
+        if (it->sample->isLoading())
+        {
+            if ((Sint32)(now - it->deadline) >= 0)
+            {
+                fprintf(stderr, "Error - sample '%s' did not load within %d ms, dropping play on channel %d.\n",
+                        it->sample->sourceUri.c_str(), loadDeadline, it->channel);
+                manager.Release(it->sample);
+                it = pendingPlays.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+            continue;
+        }
+
+        if (it->sample->isValid())
+        {
+            if ((it->startFrame != 0 && !frameDue(it->startFrame)) || (it->group != 0 && groupLoading(it->group)))
+            {
+                ++it;
+                continue;
+            }
+            if (it->group != 0)
+            {
+                // Starting the group takes its plays out of the list, so the scan starts over
+                startGroup(it->group);
+                it = pendingPlays.begin();
+                continue;
+            }
+            startPlay(*it);
+        }
+        else
+        {
+            printf("Error - could not load requested sample '%s'\n", it->sample->sourceUri.c_str());
+        }
+        manager.Release(it->sample);
+        it = pendingPlays.erase(it);
+    }
+}
+
+// Opens a stream on its own thread, since both the pre-roll and the decoder's
+// header reads block until enough of the download has arrived
+int openStream(void *data)
+{
+    StreamPlay *play = (StreamPlay *)data;
+
+    SDL_RWops *source = SDL_RWFromHttpStream(play->uri.c_str(), streamPreroll);
+    play->music = source != NULL ? Mix_LoadMUS_RW(source, 1) : NULL;
+    if (play->music == NULL)
+    {
+        fprintf(stderr, "Error - could not stream requested sample '%s': %s\n", play->uri.c_str(), SDL_GetError());
+        delete play;
+        return 0;
+    }
+
+    // From here on the stream is decoded on the audio thread, which must never wait for
+    // the download; a download that falls behind ends the play instead of stalling the mixer
+    SDL_RWHttpStreamSetBlocking(source, SDL_FALSE);
+
+    SDL_LockMutex(streamLock);
+    if (play->generation == streamGeneration && openedStream == NULL)
+    {
+        openedStream = play;
+        play = NULL;
+    }
+    SDL_UnlockMutex(streamLock);
+
+    if (play != NULL)
+    {
+        // A newer stream or a stop was requested while this one was opening
+        Mix_FreeMusic(play->music);
+        delete play;
+    }
+    else
+    {
+        SDL_SemPost(executorWakeup);
+    }
+    return 0;
+}
+
+// Starts the stream handed over by openStream, replacing the current one
+void startOpenedStream(void)
+{
+    SDL_LockMutex(streamLock);
+    StreamPlay *play = openedStream;
+    openedStream = NULL;
+    SDL_UnlockMutex(streamLock);
+
+    if (play == NULL)
+    {
+        return;
+    }
+
+    Mix_HaltMusic();
+    if (currentStream != NULL)
+    {
+        Mix_FreeMusic(currentStream);
+    }
+    currentStream = play->music;
+    streamVolume = play->volume;
+    currentStreamBgm = play->bgm;
+
+    if (verbose)
+    {
+        printf("Streaming sound %s, %s, at volume %.2f, under master volume %.2f\n", play->uri.c_str(), play->loop ? "looping" : "once", streamVolume, masterVolume);
+    }
+
+    Mix_VolumeMusic(static_cast<int>(streamVolume * MIX_MAX_VOLUME));
+    Mix_PlayMusic(currentStream, play->loop ? -1 : 1);
+    delete play;
+}
+
+// Plays a remote audio file while it is still downloading; streams play on the music channel
+void playStream(const char *file, bool loop, float volume, bool bgm)
+{
+    StreamPlay *play = new StreamPlay;
+    play->uri = resolveUri(file);
+    play->loop = loop;
+    play->volume = volume;
+    play->bgm = bgm;
+    play->music = NULL;
+    requestedStreamBgm = bgm;
+
+    SDL_LockMutex(streamLock);
+    play->generation = ++streamGeneration;
+    SDL_UnlockMutex(streamLock);
+
+    SDL_Thread *thread = SDL_CreateThread(openStream, "stream", play);
+    if (thread == NULL)
+    {
+        fprintf(stderr, "Unable to start stream thread: %s\n", SDL_GetError());
+        delete play;
+        return;
+    }
+    SDL_DetachThread(thread);
+}
+
+// Whether a play is streamed rather than loaded up front; only remote files can be
+bool playStreams(const char *file, bool stream)
+{
+    return stream && 0 == strncmp(resolveUri(file).c_str(), HTTP_PROTOCOL_PREFIX, strlen(HTTP_PROTOCOL_PREFIX));
+}
+
+// Function to play an audio sample with specified parameters; plays of a batch's group
+// are held until all of the group's samples are ready
+void playSample(const char *file, int channel, bool loop, float volume, float pan, int priority, int id, int bus, bool exclusive, bool keepBgm, int maxPlayLength, int fadeIn, RampCurve curve, bool nocache, bool stream, uint64_t startFrame, unsigned group)
+{
+    // Limit the sample volume between 0.0 and 1.0, and the pan between -1.0 and 1.0
+    if (volume < 0.0f) volume = 0.0f;
+    if (volume > 1.0f) volume = 1.0f;
+    if (pan < -1.0f) pan = -1.0f;
+    if (pan > 1.0f) pan = 1.0f;
+
+    // Remote files can be streamed instead of being downloaded and decoded up front;
+    // streams start as soon as they are buffered, even when scheduled
+    if (playStreams(file, stream))
+    {
+        if (exclusive)
+        {
+            stopAll(!keepBgm);
+        }
+        playStream(file, loop, volume, bus == bgmBus);
+        return;
+    }
+
+    // A newer play on the same channel supersedes one still waiting for its sample,
+    // but not the ones scheduled for a frame; plays on any free voice all get one
+    if (channel != -1)
+    {
+        cancelPendingPlays(channel, 1);
+    }
+
+    // Handle the nocache parameter; voices and pending plays keep their own reference
+    if (nocache)
+    {
+        manager.RemoveSample(resolveUri(file));
+        if (verbose)
+        {
+            printf("Removed sample '%s' from cache due to nocache=true.\n", file);
+        }
+    }
+
+    PendingPlay play;
+    Uint64 start = stageRecorder != NULL ? SDL_GetPerformanceCounter() : 0;
+    play.sample = precacheSample(file); // Preload the sample
+    if (stageRecorder != NULL)
+    {
+        stageRecorder(STAGE_CACHE_LOOKUP, SDL_GetPerformanceCounter() - start);
+    }
+    play.channel = channel;
+    play.loop = loop;
+    play.volume = volume;
+    play.pan = pan;
+    play.priority = priority;
+    play.id = id;
+    play.bus = bus;
+    play.keepBgm = keepBgm;
+    play.exclusive = exclusive;
+    play.maxPlayLength = maxPlayLength;
+    play.fadeIn = fadeIn;
+    play.curve = curve;
+    play.startFrame = startFrame;
+    play.group = group;
+
+    // A scheduled play's sample loads meanwhile, and only has to be ready by its start
+    Sint32 wait = startFrame != 0 ? mixerClock.MillisecondsUntil(startFrame) : 0;
+    play.deadline = SDL_GetTicks() + wait + loadDeadline;
+
+    if (play.sample->isLoading() || (play.sample->isValid() && ((startFrame != 0 && !frameDue(startFrame)) || group != 0)))
+    {
+        if (verbose && group != 0)
+        {
+            printf("Sample '%s' starts on channel %d along with the other plays of its batch.\n", file, channel);
+        }
+        else if (verbose && startFrame != 0)
+        {
+            printf("Scheduled sample '%s' to start on channel %d in %d ms.\n", file, channel, wait);
+        }
+        else if (verbose)
+        {
+            printf("Sample '%s' is still loading, channel %d will start when it is ready.\n", file, channel);
+        }
+        manager.Retain(play.sample);
+        pendingPlays.push_back(play);
+    }
+    else if (play.sample->isValid())
+    {
+        startPlay(play);
+    }
+    else
+    {
+        printf("Error - could not load requested sample '%s'\n", file);
+    }
+}
+
+// Publishes a status report on the status topic, if there is one, and prints it if asked to
+void publishStatus(const char *report, bool print)
+{
+    if (print)
+    {
+        printf("%s\n", report);
+    }
+    if (mqttClient != NULL && !statusTopic.empty())
+    {
+        int rc = mosquitto_publish(mqttClient, NULL, statusTopic.c_str(), strlen(report), report, 0, false);
+        if (MOSQ_ERR_SUCCESS != rc)
+        {
+            fprintf(stderr, "Failed to publish status report (%d)\n", rc);
+        }
+    }
+}
+
+// Reports the sample cache occupancy and counters
+void reportCacheStats(void)
+{
+    SampleCacheStats stats = manager.GetStats();
+
+    StringBuffer buffer;
+    Writer<StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("event");
+    writer.String("cacheStats");
+    writer.Key("samples");
+    writer.Uint64(stats.samples);
+    writer.Key("bytes");
+    writer.Uint64(stats.bytes);
+    writer.Key("budget");
+    writer.Uint64(stats.budget);
+    writer.Key("hits");
+    writer.Uint64(stats.hits);
+    writer.Key("misses");
+    writer.Uint64(stats.misses);
+    writer.Key("evictions");
+    writer.Uint64(stats.evictions);
+    writer.EndObject();
+
+    publishStatus(buffer.GetString(), true);
+}
+
+// Whether a command is scheduled for a frame beyond the schedule window, and has to be held back
+bool scheduledLater(const Command &command)
+{
+    return command.startFrame != 0 && !frameDue(command.startFrame);
+}
+
+// Holds back a command scheduled for a later mixing period; returns false if there are
+// too many already. Such commands are carried out once their frame is within the schedule
+// window, and wait out the rest of the way to it frame by frame, as plays do.
+bool deferCommand(const Command &command, CommandHandler handler)
+{
+    if (scheduledCommands.size() >= MAX_SCHEDULED_COMMANDS)
+    {
+        fprintf(stderr, "Rejecting command '%s', there are already %d scheduled commands.\n", command.name, MAX_SCHEDULED_COMMANDS);
+        return false;
+    }
+
+    if (verbose)
+    {
+        printf("Scheduled command '%s' in %d ms.\n", command.name, mixerClock.MillisecondsUntil(command.startFrame));
+    }
+
+    ScheduledCommand scheduled;
+    scheduled.command = command;
+    scheduled.command.name = NULL;
+    scheduled.command.file = NULL;
+    scheduled.command.curveName = NULL;
+    scheduled.command.busName = NULL;
+    scheduled.command.batch = NULL;
+    scheduled.command.batchCount = 0;
+    scheduled.handler = handler;
+    scheduledCommands.push_back(scheduled);
+    return true;
+}
+
+// Carries out the scheduled commands that are due, in the order they were received
+void serviceScheduledCommands(void)
+{
+    for (auto it = scheduledCommands.begin(); it != scheduledCommands.end();)
+    {
+        if (frameDue(it->command.startFrame))
+        {
+            ScheduledCommand scheduled = *it;
+            it = scheduledCommands.erase(it);
+            scheduled.handler(scheduled.command);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Command handlers; each is only called once the fields its command requires are present
+
+bool commandPlay(const Command &command)
+{
+    int channel = command.has(FIELD_CHANNEL) ? command.channel : -1; // Default to any free voice
+    float volume = command.has(FIELD_VOLUME) ? command.volume : 1.0f;
+    float pan = command.has(FIELD_PAN) ? command.pan : 0.0f;
+    int priority = command.has(FIELD_PRIORITY) ? command.priority : 0;
+    int id = command.has(FIELD_ID) ? command.id : -1;
+    int maxPlayLength = command.has(FIELD_MAX_PLAY_LENGTH) ? command.maxPlayLength : -1;
+    int fadeIn = command.has(FIELD_FADE_IN) ? command.fadeIn : 0;
+    int bus = command.has(FIELD_BUS) ? command.bus : command.bgm ? bgmBus : -1; // Background music goes on its own bus
+
+    playSample(command.file, channel, command.loop, volume, pan, priority, id, bus, command.exclusive, command.keepBgm, maxPlayLength,
+               fadeIn, (RampCurve)command.curve, command.nocache, command.stream, command.startFrame, command.group);
+    return true;
+}
+
+bool commandStopAll(const Command &command)
+{
+    stopAll(!command.keepBgm);
+    return true;
+}
+
+bool commandFadeOut(const Command &command)
+{
+    if (scheduledLater(command))
+    {
+        return deferCommand(command, commandFadeOut);
+    }
+
+    int time = command.time;
+    int channel = command.has(FIELD_CHANNEL) ? command.channel : -1; // Default to all channels
+
+    if (verbose)
+    {
+        printf("Fading out channel %d for %d milliseconds.\n", channel, time);
+    }
+
+    // A fade out also covers plays that have not started yet, up to its own frame
+    cancelPendingPlays(channel, SDL_max(command.startFrame, mixerClock.Frames()) + 1);
+
+    // Apply fade out to specified channel or all channels
+    lockMixer();
+    fadeOutVoice(channel, time, framesUntil(command.startFrame));
+    unlockMixer();
+    if (channel == -1)
+    {
+        cancelStreams();
+        Mix_FadeOutMusic(time);       // Including the streamed play, from the start of a mixing period
+    }
+    return true;
+}
+
+bool commandPrecache(const Command &command)
+{
+    precacheSample(command.file);
+
+    if (verbose)
+    {
+        printf("Precached sound file '%s'.\n", command.file);
+    }
+    return true;
+}
+
+bool commandCacheStats(const Command &command)
+{
+    reportCacheStats();
+    return true;
+}
+
+bool commandSetVolume(const Command &command)
+{
+    if (scheduledLater(command))
+    {
+        return deferCommand(command, commandSetVolume);
+    }
+
+    // With a time, the volume ramps to the new one over it
+    int time = command.has(FIELD_TIME) ? command.time : 0;
+    lockMixer();
+    setChannelVolume(command.channel, command.volume, time, (RampCurve)command.curve, framesUntil(command.startFrame));
+    unlockMixer();
+    return true;
+}
+
+bool commandPause(const Command &command)
+{
+    pauseChannel(command.channel);
+    return true;
+}
+
+bool commandResume(const Command &command)
+{
+    resumeChannel(command.channel);
+    return true;
+}
+
+bool commandSetMasterVolume(const Command &command)
+{
+    if (scheduledLater(command))
+    {
+        return deferCommand(command, commandSetMasterVolume);
+    }
+
+    masterVolume = command.volume;
+
+    if (masterVolume < 0.0f) masterVolume = 0.0f;
+    if (masterVolume > 1.0f) masterVolume = 1.0f;
+
+    // The output ramps to the new volume over the time, or just long enough not to click;
+    // voices started meanwhile follow the same ramp
+    int time = command.has(FIELD_TIME) ? command.time : masterSmoothingMs;
+    if (verbose)
+    {
+        printf("Master volume set to %.2f over %d ms\n", masterVolume, time);
+    }
+
+    lockMixer();
+    masterGain.Start(masterVolume, (int)((Sint64)time * mixerClock.Frequency() / 1000), (RampCurve)command.curve, framesUntil(command.startFrame));
+    unlockMixer();
+    return true;
+}
+
+bool commandBusSetVolume(const Command &command)
+{
+    if (scheduledLater(command))
+    {
+        return deferCommand(command, commandBusSetVolume);
+    }
+
+    float volume = SDL_max(0.0f, SDL_min(1.0f, command.volume));
+    int time = command.has(FIELD_TIME) ? command.time : 0;
+    if (verbose)
+    {
+        printf("Set volume of bus '%s' to %.2f over %d ms\n", buses[command.bus].name.c_str(), volume, time);
+    }
+    lockMixer();
+    setBusVolume(command.bus, volume, time, (RampCurve)command.curve, framesUntil(command.startFrame));
+    unlockMixer();
+    return true;
+}
+
+bool commandBusFadeOut(const Command &command)
+{
+    if (scheduledLater(command))
+    {
+        return deferCommand(command, commandBusFadeOut);
+    }
+
+    if (verbose)
+    {
+        printf("Fading out bus '%s' for %d milliseconds.\n", buses[command.bus].name.c_str(), command.time);
+    }
+
+    // Like a fade out of a channel, it also covers the bus's plays up to its own frame
+    cancelBusPlays(command.bus, false, SDL_max(command.startFrame, mixerClock.Frames()) + 1);
+    lockMixer();
+    fadeOutBus(command.bus, command.time, framesUntil(command.startFrame));
+    unlockMixer();
+    return true;
+}
+
+bool commandBusStop(const Command &command)
+{
+    if (scheduledLater(command))
+    {
+        return deferCommand(command, commandBusStop);
+    }
+
+    if (verbose)
+    {
+        printf("Stopping bus '%s'.\n", buses[command.bus].name.c_str());
+    }
+
+    // Like stopall, it also cancels the bus's pending plays, but a scheduled stop only
+    // those that would start by its own frame
+    cancelBusPlays(command.bus, false, command.startFrame != 0 ? command.startFrame + 1 : UINT64_MAX);
+    lockMixer();
+    haltBus(command.bus, framesUntil(command.startFrame));
+    unlockMixer();
+    return true;
+}
+
+bool commandBusPause(const Command &command)
+{
+    if (verbose)
+    {
+        printf("Paused bus '%s'\n", buses[command.bus].name.c_str());
+    }
+    pauseBus(command.bus, true);
+    return true;
+}
+
+bool commandBusResume(const Command &command)
+{
+    if (verbose)
+    {
+        printf("Resumed bus '%s'\n", buses[command.bus].name.c_str());
+    }
+    pauseBus(command.bus, false);
+    return true;
+}
+
+// Pausing and resuming take effect at the start of a mixing period, so unlike the other
+// commands they cannot be scheduled for a frame; returns whether a command tries to
+bool unschedulable(const Command &command, const CommandSpec *spec)
+{
+    if (command.startFrame != 0 && (spec->handler == commandBusPause || spec->handler == commandBusResume))
+    {
+        fprintf(stderr, "Command '%s' cannot be scheduled, pausing and resuming take effect at the start of a mixing period.\n", command.name);
+        return true;
+    }
+    return false;
+}
+
+bool commandBatch(const Command &command)
+{
+    // Plays on the batch's own frame form a group, held until all of their samples are
+    // ready and then started together, so they start on the same frame
+    unsigned group = ++batchGroups;
+    if (group == 0)
+    {
+        group = ++batchGroups;
+    }
+
+    // Validate every command first, so a batch is applied entirely or not at all; the
+    // samples of its plays are requested meanwhile, and one that failed to load rejects it
+    const CommandSpec *specs[MAX_BATCH_COMMANDS];
+    size_t deferred = 0;
+    for (int i = 0; i < command.batchCount; i++)
+    {
+        command.batch[i].received = command.received;
+        specs[i] = prepareCommand(command.batch[i]);
+        if (specs[i] == NULL)
         {
-            fprintf(stderr, "Message does not have a 'channel' property that is an int.\n");
+            fprintf(stderr, "Rejecting batch, its command %d is invalid.\n", i);
             return false;
         }
 
-        if (!d["message"].HasMember("volume") || !d["message"]["volume"].IsFloat())
+        // Commands without a schedule of their own follow the batch's
+        if (command.batch[i].startFrame == 0)
+        {
+            command.batch[i].startFrame = command.startFrame;
+        }
+        if (unschedulable(command.batch[i], specs[i]))
         {
-            fprintf(stderr, "Message does not have a 'volume' property that is a float.\n");
+            fprintf(stderr, "Rejecting batch, its command %d cannot be scheduled.\n", i);
             return false;
         }
+        if (specs[i]->handler != commandPlay && scheduledLater(command.batch[i]))
+        {
+            deferred++;
+        }
+
+        const Command &play = command.batch[i];
+        if (specs[i]->handler == commandPlay && !playStreams(play.file, play.stream))
+        {
+            Sample *sample = precacheSample(play.file);
+            if (!sample->isLoading() && !sample->isValid())
+            {
+                fprintf(stderr, "Rejecting batch, the sample '%s' of its command %d failed to load.\n", play.file, i);
+                return false;
+            }
+            if (play.startFrame == command.startFrame)
+            {
+                command.batch[i].group = group;
+            }
+        }
+    }
+
+    if (scheduledCommands.size() + deferred > MAX_SCHEDULED_COMMANDS)
+    {
+        fprintf(stderr, "Rejecting batch, there is no room for its %d scheduled commands.\n", (int)deferred);
+        return false;
+    }
+
+    if (verbose)
+    {
+        printf("Applying batch of %d commands.\n", command.batchCount);
+    }
+
+    // No handler runs with the mixer locked; the plays of the group only go on the pending
+    // list, and are started with the mixer locked just for the calls that start them
+    bool result = true;
+    for (int i = 0; i < command.batchCount; i++)
+    {
+        result = specs[i]->handler(command.batch[i]) && result;
+    }
+    servicePendingPlays();
+    return result;
+}
+
+// Commands understood by the player, the message fields each of them requires and
+// their handlers; names are matched case-insensitively. A new command only needs an entry here.
+static constexpr CommandSpec commandSpecs[] =
+{
+    { "soundPlay", FIELD_FILE, commandPlay },
+    { "play", FIELD_FILE, commandPlay },
+    { "soundStopAll", 0, commandStopAll },
+    { "stopall", 0, commandStopAll },
+    { "soundFadeOut", FIELD_TIME, commandFadeOut },
+    { "fadeout", FIELD_TIME, commandFadeOut },
+    { "soundPrecache", FIELD_FILE, commandPrecache },
+    { "precache", FIELD_FILE, commandPrecache },
+    { "cacheStats", 0, commandCacheStats },
+    { "soundSetVolume", FIELD_CHANNEL | FIELD_VOLUME, commandSetVolume },
+    { "soundPause", FIELD_CHANNEL, commandPause },
+    { "soundResume", FIELD_CHANNEL, commandResume },
+    { "setMasterVolume", FIELD_VOLUME, commandSetMasterVolume },
+    { "busSetVolume", FIELD_BUS | FIELD_VOLUME, commandBusSetVolume },
+    { "busFadeOut", FIELD_BUS | FIELD_TIME, commandBusFadeOut },
+    { "busStop", FIELD_BUS, commandBusStop },
+    { "busPause", FIELD_BUS, commandBusPause },
+    { "busResume", FIELD_BUS, commandBusResume },
+    { "batch", FIELD_BATCH, commandBatch },
+};
+
+static constexpr CommandDispatch<SDL_arraysize(commandSpecs)> commandDispatch(commandSpecs);
+
+const CommandSpec *commandTable(size_t *count)
+{
+    *count = SDL_arraysize(commandSpecs);
+    return commandSpecs;
+}
+
+const CommandSpec *findCommand(const char *name)
+{
+    return commandDispatch.Find(name);
+}
+
+// Resolves the 'at' wall clock time and the 'delay' of a command to the mixer frame
+// it takes effect at
+uint64_t scheduleFrame(const Command &command)
+{
+    double frequency = SDL_GetPerformanceFrequency();
+    double counter = command.received;
+    if (command.has(FIELD_AT))
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        double nowMs = now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+        counter = SDL_GetPerformanceCounter() + (command.at - nowMs) * frequency / 1000;
+    }
+    if (command.has(FIELD_DELAY))
+    {
+        counter += command.delay * frequency / 1000;
+    }
+
+    // Frame 0 means 'at once', and a time in the past resolves to the next period anyway
+    uint64_t frame = mixerClock.FrameAt(counter > 0 ? (Uint64)counter : 0);
+    return frame > 0 ? frame : 1;
+}
+
+// Looks up a command and checks its fields; returns NULL if it cannot be executed
+const CommandSpec *prepareCommand(Command &command)
+{
+    if (command.name == NULL)
+    {
+        fprintf(stderr, "Message does not have a 'command' property that is a string.\n");
+        return NULL;
+    }
+
+    const CommandSpec *spec = findCommand(command.name);
+    if (spec == NULL)
+    {
+        fprintf(stderr, "Unknown command '%s'.\n", command.name);
+        return NULL;
+    }
+
+    // Numeric sample references index the --preload list
+    if (command.has(FIELD_SAMPLE) && !command.has(FIELD_FILE))
+    {
+        if (command.sample < 0 || command.sample >= (int)preloads.size())
+        {
+            fprintf(stderr, "Sample %d is not one of the %d preloaded samples.\n", command.sample, (int)preloads.size());
+            return NULL;
+        }
+        command.file = preloads[command.sample].c_str();
+        command.fields |= FIELD_FILE;
+    }
+
+    if (!CommandHasFields(command, spec->required))
+    {
+        return NULL;
+    }
+
+    // Channels name a voice of the pool, or all of them with -1; checked up front so
+    // a batch with a channel out of range is rejected before any of it is applied
+    if (command.has(FIELD_CHANNEL) && (command.channel < -1 || command.channel >= maxVoices))
+    {
+        fprintf(stderr, "Channel %d is out of range, there are %d voices.\n", command.channel, maxVoices);
+        return NULL;
+    }
+
+    // Ramps and fade ins are linear unless a curve is named
+    RampCurve curve = CURVE_LINEAR;
+    if (command.has(FIELD_CURVE) && !ParseRampCurve(command.curveName, &curve))
+    {
+        fprintf(stderr, "Unknown curve '%s'.\n", command.curveName);
+        return NULL;
+    }
+    command.curve = curve;
+
+    if (command.has(FIELD_BUS))
+    {
+        // Buses are created by the plays on them, so a misspelled name in a bus command is an error
+        bool create = spec->handler == commandPlay;
+        command.bus = findBus(command.busName, create);
+        if (command.bus == -1 && create)
+        {
+            fprintf(stderr, "No room for bus '%s', there are already %d buses.\n", command.busName, MAX_BUSES);
+            return NULL;
+        }
+        if (command.bus == -1)
+        {
+            fprintf(stderr, "Unknown bus '%s', no play has used it yet.\n", command.busName);
+            return NULL;
+        }
+    }
+
+    if (command.has(FIELD_AT) || command.has(FIELD_DELAY))
+    {
+        command.startFrame = scheduleFrame(command);
+        if (unschedulable(command, spec))
+        {
+            return NULL;
+        }
+    }
+
+    return spec;
+}
+
+// MQTT message callback function
+void message_callback(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message)
+{
+    // Routed commands are recognized by their topic alone
+    int route = ROUTE_NONE;
+    int channel = 0;
+    if (!router.IsEmpty())
+    {
+        const char *parameter = NULL;
+        route = router.Match(message->topic, &parameter);
+        if (route != ROUTE_NONE)
+        {
+            char *end;
+            channel = strtol(parameter, &end, 10);
+            if (end == parameter || *end != '\0')
+            {
+                fprintf(stderr, "Topic '%s' does not end in a channel number.\n", message->topic);
+                return;
+            }
+        }
+    }
+
+    bool match = route != ROUTE_NONE;
+    if (!match)
+    {
+        mosquitto_topic_matches_sub(topic.c_str(), message->topic, &match);
+    }
+
+    if (match)
+    {
+        // Only copy the payload here; it is parsed and executed on the executor thread
+        QueuedCommand *queued = commandQueue.BeginPush();
+        if (queued == NULL)
+        {
+            fprintf(stderr, "Command queue is full, dropping command '%.*s'.\n", message->payloadlen, (const char *)message->payload);
+            return;
+        }
+
+        queued->payload.assign((const char *)message->payload, message->payloadlen);
+        queued->route = route;
+        queued->channel = channel;
+        queued->received = SDL_GetPerformanceCounter();
+        commandQueue.EndPush();
+        SDL_SemPost(executorWakeup);
+    }
+}
+
+// Builds the command of a routed message from its topic and bare payload
+bool decodeRoutedCommand(const QueuedCommand &queued, char *payload, Command &command)
+{
+    const RouteSpec &spec = routeSpecs[queued.route];
+
+    memset(&command, 0, sizeof(command));
+    command.name = spec.command;
+    command.channel = queued.channel;
+    command.fields = FIELD_CHANNEL | spec.field;
+
+    char *end = payload;
+    switch (spec.field)
+    {
+    case FIELD_FILE:
+        command.file = payload;
+        end = payload + queued.payload.size();
+        break;
+    case FIELD_VOLUME:
+        command.volume = strtof(payload, &end);
+        break;
+    case FIELD_TIME:
+        command.time = strtol(payload, &end, 10);
+        break;
+    }
+
+    // Numbers may be surrounded by whitespace, but nothing else, as the channel in the topic
+    while (isspace((unsigned char)*end))
+    {
+        end++;
+    }
+    if (end == payload || *end != '\0')
+    {
+        fprintf(stderr, "Payload of a routed '%s' command is empty or not a number.\n", spec.command);
+        return false;
+    }
+    return true;
+}
+
+// Called on a loader thread when a sample has finished loading
+void sampleLoaded(Sample *sample, void *data)
+{
+    if (stageRecorder != NULL)
+    {
+        stageRecorder(STAGE_LOAD, sample->loadTime);
+    }
+
+    if (executorWakeup != NULL)
+    {
+        SDL_SemPost(executorWakeup);
+    }
+}
+
+// Command executor thread: drains the command queue, so all Mix_* calls happen here
+int executorLoop(void *data)
+{
+    // Per-thread decoder, whose parse stack arena is reset after every command
+    CommandDecoder decoder;
+    std::vector<char> insitu;                  // Payload copy parsed in place, keeping the queued payload intact
+
+    while (executorRunning)
+    {
+        if (pendingPlays.empty() && scheduledCommands.empty())
+        {
+            SDL_SemWait(executorWakeup);
+        }
+        else
+        {
+            // Wake up in time to drop plays whose sample misses its deadline, and
+            // to carry out scheduled plays and commands ahead of their frame
+            Sint32 wait = loadDeadline;
+            Uint32 now = SDL_GetTicks();
+            for (const auto &play : pendingPlays)
+            {
+                wait = SDL_min(wait, (Sint32)(play.deadline - now));
+                if (play.startFrame != 0)
+                {
+                    wait = SDL_min(wait, millisecondsUntilDue(play.startFrame));
+                }
+            }
+            for (const auto &scheduled : scheduledCommands)
+            {
+                wait = SDL_min(wait, millisecondsUntilDue(scheduled.command.startFrame));
+            }
+            SDL_SemWaitTimeout(executorWakeup, wait > 0 ? wait : 0);
+        }
+
+        // Service pending plays before every command, so they keep their order
+        // relative to commands that stop channels or drop samples from the cache
+        servicePendingPlays();
+        serviceScheduledCommands();
+        startOpenedStream();
+
+        QueuedCommand *queued;
+        while ((queued = commandQueue.Front()) != NULL)
+        {
+            servicePendingPlays();
+            serviceScheduledCommands();
+
+            Uint64 start = 0;
+            if (stageRecorder != NULL)
+            {
+                start = SDL_GetPerformanceCounter();
+                stageRecorder(STAGE_QUEUE, start - queued->received);
+            }
+
+            const char *payload = queued->payload.c_str();
+            insitu.assign(payload, payload + queued->payload.size() + 1);
+            Command command;
+            bool decoded = queued->route != ROUTE_NONE
+                ? decodeRoutedCommand(*queued, insitu.data(), command)
+                : decoder.Decode(insitu.data(), queued->payload.size(), command);
+
+            const CommandSpec *spec = NULL;
+            if (decoded)
+            {
+                command.received = queued->received;
+                if (stageRecorder != NULL)
+                {
+                    Uint64 now = SDL_GetPerformanceCounter();
+                    stageRecorder(STAGE_PARSE, now - start);
+                    start = now;
+                }
+
+                spec = prepareCommand(command);
+
+                if (stageRecorder != NULL)
+                {
+                    stageRecorder(STAGE_DISPATCH, SDL_GetPerformanceCounter() - start);
+                }
+            }
+
+            if (spec == NULL || !spec->handler(command))
+            {
+                if ((uint8_t)payload[0] == BINARY_COMMAND_MAGIC)
+                {
+                    fprintf(stderr, "Failed to process binary command of %d bytes.\n", (int)queued->payload.size());
+                }
+                else
+                {
+                    fprintf(stderr, "Failed to process command '%s'.\n", payload);
+                }
+            }
+            commandQueue.Pop();
+        }
+
+        // Evict only once this round's plays have started, so their samples count as in use
+        manager.Trim();
+        manager.CollectReleased();
+    }
+
+    return 0;
+}
+
+bool commandQueueEmpty(void)
+{
+    return commandQueue.Empty();
+}
 
-        int channel = d["message"]["channel"].GetInt();
-        float volume = d["message"]["volume"].GetFloat();
+// Only meaningful on the thread that pushes commands
+bool commandQueueFull(void)
+{
+    return commandQueue.BeginPush() == NULL;
+}
+
+// Starts the command executor thread
+bool startExecutor(void)
+{
+    executorWakeup = SDL_CreateSemaphore(0);
+    streamLock = SDL_CreateMutex();
+    if (executorWakeup == NULL || streamLock == NULL)
+    {
+        fprintf(stderr, "Unable to create executor synchronization: %s\n", SDL_GetError());
+        return false;
+    }
+
+    executorRunning = true;
+    executorThread = SDL_CreateThread(executorLoop, "executor", NULL);
+    if (executorThread == NULL)
+    {
+        fprintf(stderr, "Unable to start executor thread: %s\n", SDL_GetError());
+        executorRunning = false;
+        return false;
+    }
+
+    return true;
+}
+
+// Stops the command executor thread and waits for it to finish the current command
+void stopExecutor(void)
+{
+    if (executorThread != NULL)
+    {
+        executorRunning = false;
+        SDL_SemPost(executorWakeup);
+        SDL_WaitThread(executorThread, NULL);
+        executorThread = NULL;
+    }
 
-        setChannelVolume(channel, volume);
-        return true;
+    if (executorWakeup != NULL)
+    {
+        SDL_DestroySemaphore(executorWakeup);
+        executorWakeup = NULL;
     }
-    else if (0 == strcasecmp(command, "soundPause"))
+}
+
+// Shortest and longest periods tried when tuning, how long each one is tried for after
+// the first periods it skips, and the rate of xruns while running beyond which a tuned
+// period is doubled for the next start
+const int tuneMinPeriod = 128;
+const int tuneMaxPeriod = 4096;
+const Uint32 tuneSkipMs = 200;
+const Uint32 tuneTrialMs = 2000;
+const double tuneXrunsPerMinute = 1.0;
+
+// Name the tuned period of the output device is kept under
+std::string periodDevice(void)
+{
+    const char *driver = SDL_GetCurrentAudioDriver();
+    const char *device = getenv("AUDIODEV");
+    return std::string(driver != NULL ? driver : "default") + ":" + (device != NULL && *device != '\0' ? device : "default");
+}
+
+// Reads the tuned periods, one "<device> <frames>" line per device
+std::unordered_map<std::string, int> readTunedPeriods(void)
+{
+    std::unordered_map<std::string, int> periods;
+    FILE *file = fopen(periodFile.c_str(), "r");
+    if (file != NULL)
     {
-        if (!d.HasMember("message") || !d["message"].IsObject())
+        char device[256];
+        int period;
+        while (fscanf(file, "%255s %d", device, &period) == 2)
         {
-            fprintf(stderr, "Message does not have a 'message' property that is an object.\n");
-            return false;
+            periods[device] = period;
         }
+        fclose(file);
+    }
+    return periods;
+}
 
-        if (!d["message"].HasMember("channel") || !d["message"]["channel"].IsInt())
-        {
-            fprintf(stderr, "Message does not have a 'channel' property that is an int.\n");
-            return false;
-        }
+// Keeps the period tuned for the output device for the next start
+void writeTunedPeriod(int period)
+{
+    std::unordered_map<std::string, int> periods = readTunedPeriods();
+    periods[periodDevice()] = period;
 
-        int channel = d["message"]["channel"].GetInt();
-        pauseChannel(channel);
-        return true;
+    FILE *file = fopen(periodFile.c_str(), "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to write the tuned period to %s\n", periodFile.c_str());
+        return;
     }
-    else if (0 == strcasecmp(command, "soundResume"))
+    for (const auto &entry : periods)
     {
-        if (!d.HasMember("message") || !d["message"].IsObject())
-        {
-            fprintf(stderr, "Message does not have a 'message' property that is an object.\n");
-            return false;
-        }
-
-        if (!d["message"].HasMember("channel") || !d["message"]["channel"].IsInt())
-        {
-            fprintf(stderr, "Message does not have a 'channel' property that is an int.\n");
-            return false;
-        }
+        fprintf(file, "%s %d\n", entry.first.c_str(), entry.second);
+    }
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "Unable to write the tuned period to %s\n", periodFile.c_str());
+    }
+}
 
-        int channel = d["message"]["channel"].GetInt();
-        resumeChannel(channel);
-        return true;
+// Opens the audio device with the given period and starts counting the frames it mixes
+bool openMixer(int period)
+{
+    // SDL_mixer opens its device with SDL_OpenAudioDevice(), so SDL_LockAudio() would not
+    // lock it, and it keeps the id to itself. Nothing else opens audio devices, and only
+    // this thread, so the id is the one device the open starts; without it the mixer
+    // could not be locked at all, so the open fails unless exactly one device started.
+    bool running[maxAudioDevices];
+    for (SDL_AudioDeviceID id = 1; id < maxAudioDevices; id++)
+    {
+        running[id] = SDL_GetAudioDeviceStatus(id) != SDL_AUDIO_STOPPED;
+    }
+    if (Mix_OpenAudioDevice(frequency, AUDIO_S16SYS, 2, period, NULL, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE) < 0)
+    {
+        fprintf(stderr, "Unable to open audio: %s\n", SDL_GetError());
+        return false;
     }
-    else if (0 == strcasecmp(command, "setMasterVolume"))
+    mixerDevice = 0;
+    int started = 0;
+    for (SDL_AudioDeviceID id = 1; id < maxAudioDevices; id++)
     {
-        if (d.HasMember("message") && d["message"].IsObject())
+        if (!running[id] && SDL_GetAudioDeviceStatus(id) != SDL_AUDIO_STOPPED)
         {
-            if (d["message"].HasMember("volume") && d["message"]["volume"].IsFloat())
-            {
-                masterVolume = d["message"]["volume"].GetFloat();
-
-                if (masterVolume < 0.0f) masterVolume = 0.0f;
-                if (masterVolume > 1.0f) masterVolume = 1.0f;
-
-                if (verbose)
-                {
-                    printf("Master volume set to %.2f\n", masterVolume);
-                }
-
-                // Update the volume of all channels
-                for (const auto& kv : channelVolumes)
-                {
-                    int channel = kv.first;
-                    float channelVolume = kv.second;
-
-                    // Recalculate the effective volume
-                    float effectiveVolume = channelVolume * masterVolume;
-                    if (effectiveVolume < 0.0f) effectiveVolume = 0.0f;
-                    if (effectiveVolume > 1.0f) effectiveVolume = 1.0f;
-
-                    int sdlVolume = static_cast<int>(effectiveVolume * MIX_MAX_VOLUME);
-                    Mix_Volume(channel, sdlVolume);
-
-                    if (verbose)
-                    {
-                        printf("Updated volume of channel %d to %.2f (effective volume: %.2f)\n", channel, channelVolume, effectiveVolume);
-                    }
-                }
-
-                return true;
-            }
+            mixerDevice = id;
+            started++;
         }
-        fprintf(stderr, "Invalid message format for setMasterVolume\n");
-        return false;
     }
-    else
+    if (started != 1)
     {
-        // Default case for unknown commands
-        fprintf(stderr, "Unknown command '%s'.\n", command);
+        fprintf(stderr, "Unable to tell which audio device SDL_mixer opened (%d started), so the mixer could not be locked.\n", started);
+        mixerDevice = 0;
+        Mix_CloseAudio();
         return false;
     }
+    mixerPeriod = period;
+    scheduleWindow = 2 * period;
+
+    int outputFrequency, outputChannels;
+    Uint16 outputFormat;
+    Mix_QuerySpec(&outputFrequency, &outputFormat, &outputChannels);
+    mixerClock.Start(outputFrequency, outputChannels * SDL_AUDIO_BITSIZE(outputFormat) / 8);
+    return true;
 }
 
-// MQTT message callback function
-void message_callback(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message)
+// Opens the audio device with the lowest period that mixes a trial of silence without
+// xruns, doubling the period after every trial that had some, and keeps the result
+bool tuneMixer(void)
 {
-    bool match = 0;
-    mosquitto_topic_matches_sub(topic.c_str(), message->topic, &match);
-
-    if (match)
+    for (int period = tuneMinPeriod;; period *= 2)
     {
-        Document d;
-        d.Parse((const char *)message->payload);
+        if (!openMixer(period))
+        {
+            return false;
+        }
 
-        if (!processCommand(d))
+        // The first periods after opening the device are often late, so they do not count
+        Mix_SetPostMix(postMix, NULL);
+        SDL_Delay(tuneSkipMs);
+        uint64_t xruns = mixerClock.Xruns();
+        SDL_Delay(tuneTrialMs);
+        xruns = mixerClock.Xruns() - xruns;
+        Mix_SetPostMix(NULL, NULL);
+
+        printf("Tried a period of %d frames: %llu xruns.\n", period, (unsigned long long)xruns);
+        if (xruns == 0 || period >= tuneMaxPeriod)
         {
-            fprintf(stderr, "Failed to process command '%s'.\n", (const char *)message->payload);
+            writeTunedPeriod(period);
+            return true;
         }
+        Mix_CloseAudio();
     }
 }
 
+// Reports the period the mixer runs at, the output latency it buffers and the xruns so far
+void reportLatency(void)
+{
+    std::string device = periodDevice();
+
+    StringBuffer buffer;
+    Writer<StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("event");
+    writer.String("audioLatency");
+    writer.Key("device");
+    writer.String(device.c_str());
+    writer.Key("period");
+    writer.Int(mixerPeriod);
+    writer.Key("frequency");
+    writer.Int(mixerClock.Frequency());
+    writer.Key("latency");
+    writer.Double(mixerClock.Frequency() > 0 ? 2 * mixerPeriod * 1000.0 / mixerClock.Frequency() : 0.0);
+    writer.Key("xruns");
+    writer.Uint64(mixerClock.Xruns());
+    writer.EndObject();
+
+    publishStatus(buffer.GetString(), true);
+}
+
 // Initializes the SDL audio subsystem
 bool initSDLAudio(void)
 {
@@ -455,20 +2458,91 @@ bool initSDLAudio(void)
         return false;
     }
 
-    // Set up the audio stream
-    int result = Mix_OpenAudio(frequency, AUDIO_S16SYS, 2, 512);
-    if (result < 0)
+    // Set up the audio stream, with the period tuned for the device if asked to; a device
+    // is only tuned once, after that its period is read back
+    bool opened;
+    if (tunePeriod)
+    {
+        if (periodFile.empty())
+        {
+            const char *home = getenv("HOME");
+            periodFile = std::string(home != NULL ? home : ".") + "/.mqttaudio-periods";
+        }
+        int period = readTunedPeriods()[periodDevice()];
+        if (period > 0)
+        {
+            printf("Using the period of %d frames tuned for %s.\n", period, periodDevice().c_str());
+            opened = openMixer(period);
+        }
+        else
+        {
+            // Every trial runs before the player connects, so a slow device holds it up
+            int trials = 1;
+            for (int period = tuneMinPeriod; period < tuneMaxPeriod; period *= 2)
+            {
+                trials++;
+            }
+            printf("Tuning the period for %s, which takes up to %.1f seconds before connecting...\n",
+                   periodDevice().c_str(), trials * (tuneSkipMs + tuneTrialMs) / 1000.0);
+            opened = tuneMixer();
+        }
+    }
+    else
+    {
+        opened = openMixer(mixerPeriod);
+    }
+    if (!opened)
     {
-        fprintf(stderr, "Unable to open audio: %s\n", SDL_GetError());
         return false;
     }
 
-    result = Mix_AllocateChannels(16);
-    if (result < 0)
+    int result;
+    int outputFrequency, outputChannels;
+    Uint16 outputFormat;
+    Mix_QuerySpec(&outputFrequency, &outputFormat, &outputChannels);
+
+    // Voices play either on SDL_mixer's channels or on the in-house mixer, which is fed
+    // from the post-mix callback and leaves SDL_mixer with the streamed plays only. This
+    // is the one place that holds it to 16 bit stereo output; the rest goes by the frame
+    // size the mixer clock was started with.
+    if (mixerBackend == "simd" || mixerBackend == "simd16")
     {
-        fprintf(stderr, "Unable to allocate mixing channels: %s\n", SDL_GetError());
-        return false;
+        if (outputFormat != AUDIO_S16SYS || outputChannels != 2)
+        {
+            fprintf(stderr, "The in-house mixer needs 16 bit stereo output.\n");
+            return false;
+        }
+        mixingChannels = mixingChannels > 0 ? mixingChannels : 128;
+        maxVoices = maxVoices > 0 ? SDL_max(maxVoices, mixingChannels) : 4 * mixingChannels;
+        Mix_AllocateChannels(0);
+        voiceMixer = new VoiceMixer(mixingChannels, outputFrequency,
+                                    mixerBackend == "simd" ? VoiceMixer::ACCUMULATE_FLOAT : VoiceMixer::ACCUMULATE_INT16);
+        voiceMixer->SetFinishedCallback(channelFinished);
+        printf("Mixing %d to %d voices with %s kernels.\n", mixingChannels, maxVoices, BestMixKernels().name);
+    }
+    else
+    {
+        mixingChannels = mixingChannels > 0 ? mixingChannels : 16;
+        maxVoices = maxVoices > 0 ? SDL_max(maxVoices, mixingChannels) : 4 * mixingChannels;
+        result = Mix_AllocateChannels(mixingChannels);
+        if (result < 0)
+        {
+            fprintf(stderr, "Unable to allocate mixing channels: %s\n", SDL_GetError());
+            return false;
+        }
+        Mix_ChannelFinished(channelFinished);
+
+        // Sized for the whole pool up front, since playing channels point into them
+        voiceDelays.resize(maxVoices);
+        for (auto &voiceDelay : voiceDelays)
+        {
+            voiceDelay.line.resize(scheduleWindow * mixerClock.FrameBytes());
+        }
+        voiceRamps.resize(maxVoices);
     }
+    voiceSamples = vector<std::atomic<Sample *>>(maxVoices);
+    voiceInfos.resize(maxVoices);
+    Mix_SetPostMix(postMix, NULL);
 
     // Set up HTTP/CURL library
     result = SDL_RWHttpInit();
@@ -481,6 +2555,7 @@ bool initSDLAudio(void)
     return true;
 }
 
+#ifndef MQTTAUDIO_BENCH
 // Argument parsing function
 static int parse_opt(int key, char *arg, struct argp_state *state)
 {
@@ -522,6 +2597,214 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
         }
         break;
 
+    case 201: // Loader threads
+        if (arg != NULL && *arg != '\0')
+        {
+            loadThreads = atoi(arg);
+            if (loadThreads < 1)
+            {
+                argp_error(state, "at least one loader thread is required");
+            }
+            printf("Using %d sample loader threads.\n", loadThreads);
+        }
+        break;
+
+    case 202: // Load deadline
+        if (arg != NULL && *arg != '\0')
+        {
+            loadDeadline = atoi(arg);
+            printf("Dropping plays whose sample takes longer than %d ms to load.\n", loadDeadline);
+        }
+        break;
+
+    case 203: // Stream pre-roll
+        if (arg != NULL && *arg != '\0')
+        {
+            streamPreroll = atoi(arg);
+            printf("Buffering %d bytes before streamed plays start.\n", streamPreroll);
+        }
+        break;
+
+    case 204: // HTTP cache directory
+        if (arg != NULL && *arg != '\0')
+        {
+            printf("Caching downloaded samples in '%s'\n", arg);
+            SDL_SetHint(SDL_RWHTTP_HINT_CACHEDIR, arg);
+        }
+        break;
+
+    case 205: // HTTP cache size
+        if (arg != NULL && *arg != '\0')
+        {
+            printf("Limiting the download cache to %d MB.\n", atoi(arg));
+            SDL_SetHint(SDL_RWHTTP_HINT_CACHESIZE, arg);
+        }
+        break;
+
+    case 206: // PCM cache directory
+        if (arg != NULL && *arg != '\0')
+        {
+            printf("Caching converted samples in '%s'\n", arg);
+            pcmCacheDir = arg;
+        }
+        break;
+
+    case 207: // Sample cache budget
+        if (arg != NULL && *arg != '\0')
+        {
+            cacheBudget = atoi(arg);
+            printf("Limiting decoded samples in memory to %d MB.\n", cacheBudget);
+        }
+        break;
+
+    case 208: // Status topic
+        if (arg != NULL && *arg != '\0')
+        {
+            printf("Publishing status reports to '%s'\n", arg);
+            statusTopic = arg;
+        }
+        break;
+
+    case 209: // Route base topic
+        if (arg != NULL && *arg != '\0')
+        {
+            printf("Accepting topic-routed commands below '%s'\n", arg);
+            routeBase = arg;
+        }
+        break;
+
+    case 210: // Mixer backend
+        if (arg != NULL && (strcmp(arg, "sdl") == 0 || strcmp(arg, "simd") == 0 || strcmp(arg, "simd16") == 0))
+        {
+            printf("Mixing voices with the '%s' mixer.\n", arg);
+            mixerBackend = arg;
+        }
+        else
+        {
+            argp_error(state, "the mixer must be one of sdl, simd or simd16");
+        }
+        break;
+
+    case 211: // Voices
+        if (arg != NULL && *arg != '\0')
+        {
+            mixingChannels = atoi(arg);
+            if (mixingChannels < 1)
+            {
+                argp_error(state, "at least one voice is required");
+            }
+            printf("Starting with %d voices.\n", mixingChannels);
+        }
+        break;
+
+    case 212: // Max. voices
+        if (arg != NULL && *arg != '\0')
+        {
+            maxVoices = atoi(arg);
+            if (maxVoices < 1)
+            {
+                argp_error(state, "at least one voice is required");
+            }
+            printf("Growing the voice pool up to %d voices.\n", maxVoices);
+        }
+        break;
+
+    case 213: // Voice stealing
+        if (arg != NULL && strcmp(arg, "none") == 0)
+        {
+            voiceStealing = STEAL_NONE;
+        }
+        else if (arg != NULL && strcmp(arg, "priority") == 0)
+        {
+            voiceStealing = STEAL_PRIORITY;
+        }
+        else if (arg != NULL && strcmp(arg, "oldest") == 0)
+        {
+            voiceStealing = STEAL_OLDEST;
+        }
+        else if (arg != NULL && strcmp(arg, "quietest") == 0)
+        {
+            voiceStealing = STEAL_QUIETEST;
+        }
+        else
+        {
+            argp_error(state, "voice stealing must be one of none, priority, oldest or quietest");
+        }
+        if (arg != NULL)
+        {
+            printf("Stealing voices by '%s'.\n", arg);
+        }
+        break;
+
+    case 214: // Mixing period
+        if (arg != NULL && strcmp(arg, "auto") == 0)
+        {
+            printf("Tuning the mixing period to the device.\n");
+            tunePeriod = true;
+        }
+        else if (arg != NULL && atoi(arg) > 0)
+        {
+            mixerPeriod = atoi(arg);
+            printf("Mixing %d frames per period.\n", mixerPeriod);
+        }
+        else
+        {
+            argp_error(state, "the period must be a number of frames or auto");
+        }
+        break;
+
+    case 215: // Tuned period file
+        if (arg != NULL && *arg != '\0')
+        {
+            printf("Keeping tuned periods in '%s'\n", arg);
+            periodFile = arg;
+        }
+        break;
+
+    case 216: // Resampling quality
+        if (arg != NULL && strcmp(arg, "sdl") == 0)
+        {
+            resampleQuality = RESAMPLE_SDL;
+        }
+        else if (arg != NULL && strcmp(arg, "fast") == 0)
+        {
+            resampleQuality = RESAMPLE_FAST;
+        }
+        else if (arg != NULL && strcmp(arg, "medium") == 0)
+        {
+            resampleQuality = RESAMPLE_MEDIUM;
+        }
+        else if (arg != NULL && strcmp(arg, "best") == 0)
+        {
+            resampleQuality = RESAMPLE_BEST;
+        }
+        else
+        {
+            argp_error(state, "the resampling quality must be one of sdl, fast, medium or best");
+        }
+        printf("Resampling samples with '%s' quality.\n", arg);
+        break;
+
+    case 217: // Resampling threads
+        if (arg != NULL && *arg != '\0')
+        {
+            resampleThreads = atoi(arg);
+            if (resampleThreads < 1)
+            {
+                argp_error(state, "at least one resampling thread is required");
+            }
+            printf("Resampling each sample on up to %d threads.\n", resampleThreads);
+        }
+        break;
+
+    case 218: // Stream buffer
+        if (arg != NULL && *arg != '\0')
+        {
+            printf("Keeping the last %d bytes of each stream.\n", atoi(arg));
+            SDL_SetHint(SDL_RWHTTP_HINT_STREAMBUFFER, arg);
+        }
+        break;
+
     case 'd':
         if (arg != NULL && *arg != '\0')
         {
@@ -575,34 +2858,42 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
     return 0;
 }
 
-// Function to set the volume of a specific channel
-void setChannelVolume(int channel, float volume)
+#endif
+
+// Function to set the volume of a specific channel, ramping to it over ms along a curve
+// from delay frames after the next frame mixed
+void setChannelVolume(int channel, float volume, int ms, RampCurve curve, int delay)
 {
     // Limit volume between 0.0 and 1.0
     if (volume < 0.0f) volume = 0.0f;
     if (volume > 1.0f) volume = 1.0f;
 
-    // Save the channel volume
+    // Save the channel volume; the master volume applies to the mixed output
     channelVolumes[channel] = volume;
 
-    // Calculate the effective volume
-    float effectiveVolume = volume * masterVolume;
-    if (effectiveVolume < 0.0f) effectiveVolume = 0.0f;
-    if (effectiveVolume > 1.0f) effectiveVolume = 1.0f;
-
-    int sdlVolume = static_cast<int>(effectiveVolume * MIX_MAX_VOLUME);
-    Mix_Volume(channel, sdlVolume);
+    // Voices on a bus keep its gain on top of the channel volume
+    lockMixer();
+    for (int i = 0; i < (int)voiceInfos.size(); i++)
+    {
+        if (channel == -1 || channel == i)
+        {
+            VoiceInfo &info = voiceInfos[i];
+            info.volume = volume;
+            rampVoiceVolume(i, info.bus != -1 ? volume * buses[info.bus].volume : volume, ms, curve, delay);
+        }
+    }
+    unlockMixer();
 
     if (verbose)
     {
-        printf("Set volume of channel %d to %.2f (effective volume: %.2f)\n", channel, volume, effectiveVolume);
+        printf("Set volume of channel %d to %.2f, under master volume %.2f\n", channel, volume, masterVolume);
     }
 }
 
 // Function to pause playback on a specific channel
 void pauseChannel(int channel)
 {
-    Mix_Pause(channel);
+    pauseVoice(channel);
     if (verbose)
     {
         printf("Paused channel %d\n", channel);
@@ -612,13 +2903,14 @@ void pauseChannel(int channel)
 // Function to resume playback on a specific channel
 void resumeChannel(int channel)
 {
-    Mix_Resume(channel);
+    resumeVoice(channel);
     if (verbose)
     {
         printf("Resumed channel %d\n", channel);
     }
 }
 
+#ifndef MQTTAUDIO_BENCH
 // Main function
 int main(int argc, char **argv)
 {
@@ -636,6 +2928,24 @@ int main(int argc, char **argv)
         {"frequency", 'f', "frequency_in_khz", 0, "Sets the frequency for the sound output"},
         {"uri-prefix", 'u', "prefix", 0, "Sets a prefix to be prepended to all sound file locations"},
         {"preload", 200, "url", 0, "Preloads a sound sample on startup"},
+        {"load-threads", 201, "count", 0, "Number of background sample loader threads (default 2)"},
+        {"load-deadline", 202, "ms", 0, "Drops plays whose sample takes longer than this to load (default 5000)"},
+        {"stream-preroll", 203, "bytes", 0, "Bytes buffered before a streamed play starts (default 65536)"},
+        {"http-cache", 204, "dir", 0, "Keeps downloaded samples in this directory across restarts"},
+        {"http-cache-size", 205, "mb", 0, "Max. size of the download cache in MB (default 512)"},
+        {"pcm-cache", 206, "dir", 0, "Keeps samples converted to the output format in this directory"},
+        {"cache-budget", 207, "mb", 0, "Max. MB of decoded samples kept in memory (default unlimited)"},
+        {"status-topic", 208, "topic", 0, "The MQTT topic status reports are published to"},
+        {"route-base", 209, "topic", 0, "Accepts bare play, volume and fadeout commands on topics below this one"},
+        {"mixer", 210, "mixer", 0, "Mixes voices on SDL_mixer's channels (sdl, default) or in-house with float (simd) or 16 bit (simd16) accumulation"},
+        {"voices", 211, "count", 0, "Number of voices to start with (default 16 with sdl, 128 with simd and simd16)"},
+        {"max-voices", 212, "count", 0, "Number of voices the pool grows to on demand (default four times --voices)"},
+        {"steal", 213, "policy", 0, "Voice a play on any free voice takes over when all are busy: none, priority (default), oldest or quietest"},
+        {"period", 214, "frames", 0, "Frames mixed per period (default 512), or auto for the lowest period the device plays without xruns"},
+        {"period-file", 215, "file", 0, "File the auto period of each device is kept in (default ~/.mqttaudio-periods)"},
+        {"resample", 216, "quality", 0, "Converts WAV samples to the output rate at sdl, fast, medium (default) or best quality"},
+        {"resample-threads", 217, "count", 0, "Threads a long sample is resampled on (default one per CPU core)"},
+        {"stream-buffer", 218, "bytes", 0, "Bytes of a stream's download kept in memory (default 4194304)"},
         {0}
     };
 
@@ -647,6 +2957,15 @@ int main(int argc, char **argv)
         return retval;
     }
 
+    // Compile the routed command topics into the router
+    if (!routeBase.empty())
+    {
+        for (size_t i = 0; i < SDL_arraysize(routeSpecs); i++)
+        {
+            router.Add(routeBase + "/" + routeSpecs[i].pattern, i);
+        }
+    }
+
     // Initialize the SDL library
     printf("Initializing SDL library.\n");
     if (!initSDLAudio())
@@ -654,15 +2973,46 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    // Preload audio samples
+    // Start the background sample loaders
+    PcmCache *pcmCache = NULL;
+    if (!pcmCacheDir.empty())
+    {
+        pcmCache = new PcmCache(pcmCacheDir.c_str());
+        manager.SetPcmCache(pcmCache);
+    }
+    manager.SetBudget((size_t)cacheBudget * 1024 * 1024);
+    manager.SetResampling(resampleQuality, resampleThreads > 0 ? resampleThreads : SDL_GetCPUCount());
+    manager.SetLoadedCallback(sampleLoaded, NULL);
+    if (!manager.StartLoaders(loadThreads))
+    {
+        return 1;
+    }
+
+    // Preload audio samples, all of them loading in parallel and kept regardless of the budget
+    vector<Sample *> preloaded;
     for (auto &preload : preloads)
     {
-        if (precacheSample(preload.c_str()) == NULL)
+        preloaded.push_back(precacheSample(preload.c_str()));
+        manager.PinSample(preloaded.back());
+    }
+    for (size_t i = 0; i < preloads.size(); i++)
+    {
+        if (manager.WaitSample(preloaded[i]) == NULL)
         {
-            fprintf(stderr, "Failed to precache sample '%s'.\n", preload.c_str());
+            fprintf(stderr, "Failed to precache sample '%s'.\n", preloads[i].c_str());
         }
     }
 
+    // Xruns from here on count against the tuned period
+    uint64_t startupXruns = mixerClock.Xruns();
+    Uint64 startupCounter = SDL_GetPerformanceCounter();
+
+    // From here on, commands are executed on their own thread
+    if (!startExecutor())
+    {
+        return 1;
+    }
+
     // Connect to the MQTT server
     uint8_t reconnect = true;
     char clientid[128];
@@ -681,6 +3031,7 @@ int main(int argc, char **argv)
 
     if (mosq)
     {
+        mosquitto_threaded_set(mosq, true);
         mosquitto_connect_callback_set(mosq, connect_callback);
         mosquitto_message_callback_set(mosq, message_callback);
 
@@ -691,6 +3042,7 @@ int main(int argc, char **argv)
             fprintf(stderr, "Failed to connect to server %s (%d)\n", server.c_str(), rc);
             return EX_UNAVAILABLE;
         }
+        mqttClient = mosq;
 
         while (run)
         {
@@ -707,27 +3059,62 @@ int main(int argc, char **argv)
                 else
                 {
                     fprintf(stderr, "Reconnected to server %s (%d)\n", server.c_str(), rc);
-                    mosquitto_subscribe(mosq, NULL, topic.c_str(), 0);
+                    subscribeTopics(mosq);
                 }
             }
         }
-
-        mosquitto_destroy(mosq);
     }
 
     printf("Exiting mqtt audio player...\n");
 
+    // The executor may still publish status reports until it is stopped
+    printf("Stopping command executor...\n");
+    stopExecutor();
+
     printf("Cleaning up MQTT connection...\n");
+    mqttClient = NULL;
+    if (mosq)
+    {
+        mosquitto_destroy(mosq);
+    }
     mosquitto_lib_cleanup();
 
+    // A tuned period that had xruns under the real load more often than the rate allows is
+    // doubled from the next start on, up to the longest period tuning tries; runs shorter
+    // than a minute count as a minute, so a single xrun does not double it
+    uint64_t xruns = mixerClock.Xruns() - startupXruns;
+    double minutes = (SDL_GetPerformanceCounter() - startupCounter) / (60.0 * SDL_GetPerformanceFrequency());
+    if (tunePeriod && xruns > tuneXrunsPerMinute * SDL_max(minutes, 1.0) && mixerPeriod < tuneMaxPeriod)
+    {
+        int period = SDL_min(2 * mixerPeriod, tuneMaxPeriod);
+        printf("Had %llu xruns in %.1f minutes at a period of %d frames, using %d frames from the next start on.\n",
+               (unsigned long long)xruns, minutes, mixerPeriod, period);
+        writeTunedPeriod(period);
+    }
+
+    printf("Stopping streamed play...\n");
+    Mix_HaltMusic();
+    if (currentStream != NULL)
+    {
+        Mix_FreeMusic(currentStream);
+        currentStream = NULL;
+    }
+
+    printf("Stopping sample loaders...\n");
+    manager.StopLoaders();
+
     printf("Cleaning up audio samples...\n");
+    haltVoice(-1);
     manager.FreeAll();
 
     printf("Closing audio device...\n");
     Mix_CloseAudio();
+    delete voiceMixer;
+    voiceMixer = NULL;
     SDL_RWHttpShutdown();
     SDL_Quit();
 
     printf("Cleanup complete.\n");
     return 0;
 }
+#endif
@@ -0,0 +1,49 @@
+#ifndef MQTTAUDIO_H
+#define MQTTAUDIO_H
+
+#include <string>
+
+#include <mosquitto.h>
+
+#include "SDL.h"
+
+#include "command.h"
+#include "samplemanager.h"
+
+// Player internals shared with mqttaudio-bench, which builds mqttaudio.cpp
+// with MQTTAUDIO_BENCH defined to leave out its main()
+
+// Stages of the command path timed for mqttaudio-bench
+enum Stage
+{
+    STAGE_QUEUE,                               // From message_callback until the executor picks it up
+    STAGE_PARSE,                               // Decoding the payload into a Command
+    STAGE_DISPATCH,                            // Looking up and validating the command
+    STAGE_CACHE_LOOKUP,                        // Requesting the sample from the SampleManager
+    STAGE_LOAD,                                // Decoding a sample on a loader thread
+    STAGE_PLAY,                                // The Mix_PlayChannelTimed() call
+    STAGE_COUNT
+};
+
+// Receives the duration of a stage in performance counter ticks; may be called
+// from the executor and the loader threads
+typedef void (*StageRecorder)(Stage stage, Uint64 elapsed);
+
+extern StageRecorder stageRecorder;            // NULL unless benchmarking
+extern std::string topic;
+extern std::string uriprefix;
+extern std::string mixerBackend;
+extern SampleManager manager;
+
+bool initSDLAudio(void);
+void sampleLoaded(Sample *sample, void *data);
+bool startExecutor(void);
+void stopExecutor(void);
+bool commandQueueEmpty(void);
+bool commandQueueFull(void);
+void haltVoice(int channel);
+void message_callback(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message);
+const CommandSpec *commandTable(size_t *count);
+const CommandSpec *findCommand(const char *name);
+
+#endif
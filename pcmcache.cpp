@@ -0,0 +1,189 @@
+#include "pcmcache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PCM_CACHE_MAGIC "MQPCM001"
+
+// Header of a cache file, followed by the converted audio data
+struct PcmCacheHeader
+{
+    char magic[8];
+    Uint32 frequency;
+    Uint16 format;
+    Uint16 channels;
+    Uint32 length;     // Length of the audio data in bytes
+    Uint32 reserved[11];
+};
+
+static_assert(sizeof(PcmCacheHeader) == 64, "the audio data must stay 64 byte aligned");
+
+static Uint64 hashBytes(Uint64 hash, const void *data, size_t length)
+{
+    const Uint8 *bytes = (const Uint8 *)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+PcmCache::PcmCache(const char *directory) : _directory(directory)
+{
+    mkdir(directory, 0755);
+}
+
+std::string PcmCache::FileKey(const char *path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0)
+    {
+        return "";
+    }
+
+    char identity[64];
+    snprintf(identity, sizeof(identity), "|%lld|%lld", (long long)info.st_size, (long long)info.st_mtime);
+    return std::string(path) + identity;
+}
+
+std::string PcmCache::DataKey(const char *uri, SDL_RWops *source)
+{
+    Sint64 start = SDL_RWseek(source, 0, RW_SEEK_CUR);
+    if (start < 0)
+    {
+        return "";
+    }
+
+    Uint8 buffer[64 * 1024];
+    Uint64 hash = 14695981039346656037ULL;
+    Sint64 size = 0;
+    size_t read;
+    while ((read = SDL_RWread(source, buffer, 1, sizeof(buffer))) > 0)
+    {
+        hash = hashBytes(hash, buffer, read);
+        size += read;
+    }
+    SDL_RWseek(source, start, RW_SEEK_SET);
+
+    char identity[64];
+    snprintf(identity, sizeof(identity), "|%lld|%016llx", (long long)size, (unsigned long long)hash);
+    return std::string(uri) + identity;
+}
+
+// Entries are named after a hash of the source identity and the output format
+std::string PcmCache::PathFor(const std::string &key)
+{
+    int frequency;
+    Uint16 format;
+    int channels;
+    Mix_QuerySpec(&frequency, &format, &channels);
+
+    char spec[64];
+    snprintf(spec, sizeof(spec), "|%d|%04x|%d", frequency, format, channels);
+    std::string identity = key + spec;
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.pcm", (unsigned long long)hashBytes(14695981039346656037ULL, identity.data(), identity.size()));
+    return _directory + name;
+}
+
+Mix_Chunk *PcmCache::Load(const std::string &key, void **mapping, size_t *mappingLength)
+{
+    if (key.empty())
+    {
+        return NULL;
+    }
+
+    std::string path = PathFor(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size <= sizeof(PcmCacheHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // Private writable mapping: pages stay shared with the page cache unless written to
+    size_t length = info.st_size;
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    int frequency;
+    Uint16 format;
+    int channels;
+    Mix_QuerySpec(&frequency, &format, &channels);
+
+    const PcmCacheHeader *header = (const PcmCacheHeader *)map;
+    if (memcmp(header->magic, PCM_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->frequency != (Uint32)frequency || header->format != format || header->channels != channels ||
+        header->length != length - sizeof(PcmCacheHeader))
+    {
+        fprintf(stderr, "Ignoring invalid PCM cache entry %s\n", path.c_str());
+        munmap(map, length);
+        return NULL;
+    }
+
+    // Start reading the pages in ahead of playback, so the mixer does not fault on them
+    madvise(map, length, MADV_WILLNEED);
+
+    Mix_Chunk *chunk = Mix_QuickLoad_RAW((Uint8 *)map + sizeof(PcmCacheHeader), header->length);
+    if (chunk == NULL)
+    {
+        munmap(map, length);
+        return NULL;
+    }
+
+    *mapping = map;
+    *mappingLength = length;
+    return chunk;
+}
+
+void PcmCache::Store(const std::string &key, Mix_Chunk *chunk)
+{
+    if (key.empty())
+    {
+        return;
+    }
+
+    PcmCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PCM_CACHE_MAGIC, sizeof(header.magic));
+    int frequency;
+    int channels;
+    Mix_QuerySpec(&frequency, &header.format, &channels);
+    header.frequency = frequency;
+    header.channels = channels;
+    header.length = chunk->alen;
+
+    // Write to a temporary file first, so a crash never leaves a truncated entry behind
+    std::string path = PathFor(key);
+    std::string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to write PCM cache entry %s\n", temp.c_str());
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(chunk->abuf, 1, chunk->alen, file) == chunk->alen;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        fprintf(stderr, "Unable to write PCM cache entry %s\n", path.c_str());
+        unlink(temp.c_str());
+    }
+}
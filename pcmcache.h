@@ -0,0 +1,32 @@
+#ifndef PCMCACHE_H
+#define PCMCACHE_H
+
+#include <string>
+using namespace std;
+
+#include "SDL.h"
+#include "SDL_mixer.h"
+
+// Disk cache of samples already converted to the output format of the mixer.
+// Entries are keyed by the identity of their source and by the output format,
+// and are memory-mapped on load, so a cached sample needs no decoding at all.
+class PcmCache
+{
+public:
+    PcmCache(const char *directory);
+
+    // Identity of a local file: its path, size and modification time
+    static std::string FileKey(const char *path);
+    // Identity of downloaded data: its uri, size and a hash of its contents
+    static std::string DataKey(const char *uri, SDL_RWops *source);
+
+    Mix_Chunk *Load(const std::string &key, void **mapping, size_t *mappingLength);
+    void Store(const std::string &key, Mix_Chunk *chunk);
+
+private:
+    std::string PathFor(const std::string &key);
+
+    std::string _directory;
+};
+
+#endif
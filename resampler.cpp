@@ -0,0 +1,196 @@
+#include "resampler.h"
+
+#include <math.h>
+
+// Output frames below which a segment is not worth its own thread
+#define MIN_SEGMENT_FRAMES 65536
+
+// Filter phases beyond which rate ratios are left to SDL's converter, as their
+// coefficient tables would outgrow the samples they convert
+#define MAX_PHASES 1024
+
+// Taps per phase, cutoff relative to the Nyquist frequency and Kaiser window shape
+// of each quality level
+struct QualitySpec
+{
+    int taps;
+    double rolloff;
+    double beta;
+};
+
+static const QualitySpec qualitySpecs[] =
+{
+    { 0, 0.0, 0.0 },                           // RESAMPLE_SDL, not done here
+    { 16, 0.85, 6.0 },
+    { 32, 0.91, 8.0 },
+    { 64, 0.945, 10.0 },
+};
+
+static inline Sint16 saturate(float value)
+{
+    if (value >= 32767.0f) return 32767;
+    if (value <= -32768.0f) return -32768;
+    return (Sint16)lrintf(value);
+}
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        double factor = x / (2 * k);
+        term *= factor * factor;
+        sum += term;
+    }
+    return sum;
+}
+
+static int greatestCommonDivisor(int a, int b)
+{
+    while (b != 0)
+    {
+        int rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+Resampler::Resampler(int inputRate, int outputRate, int channels, ResampleQuality quality, const MixKernels &kernels) :
+    _channels(channels), _upsampling(0), _downsampling(0), _taps(0), _kernels(kernels)
+{
+    if (quality == RESAMPLE_SDL || inputRate <= 0 || outputRate <= 0 || channels <= 0)
+    {
+        return;
+    }
+
+    int divisor = greatestCommonDivisor(inputRate, outputRate);
+    _upsampling = outputRate / divisor;
+    _downsampling = inputRate / divisor;
+    if (_upsampling > MAX_PHASES)
+    {
+        return;
+    }
+
+    // When downsampling, the filter has to cut below the output's Nyquist frequency,
+    // and gets longer by the same ratio to keep its steepness
+    const QualitySpec &spec = qualitySpecs[quality];
+    double ratio = SDL_min(1.0, (double)_upsampling / _downsampling);
+    double cutoff = 0.5 * ratio * spec.rolloff;   // Cycles per input frame
+    _taps = (int)ceil(spec.taps / ratio / 8) * 8;
+    double half = _taps / 2.0;
+
+    _coefficients.resize((size_t)_upsampling * _taps * channels);
+    std::vector<double> taps(_taps);
+    for (int phase = 0; phase < _upsampling; phase++)
+    {
+        double sum = 0.0;
+        for (int tap = 0; tap < _taps; tap++)
+        {
+            // Input frames from the tap to where the output frame falls between two of them
+            double t = tap - half + 1 - (double)phase / _upsampling;
+            double x = 2 * cutoff * t;
+            double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double w = t / half;
+            double window = fabs(w) < 1.0 ? besselI0(spec.beta * sqrt(1.0 - w * w)) / besselI0(spec.beta) : 0.0;
+            taps[tap] = sinc * window;
+            sum += taps[tap];
+        }
+
+        // Every phase passes DC at unity gain, so no phase is louder than the others
+        float *coefficients = &_coefficients[(size_t)phase * _taps * channels];
+        for (int tap = 0; tap < _taps; tap++)
+        {
+            for (int channel = 0; channel < channels; channel++)
+            {
+                coefficients[tap * channels + channel] = (float)(taps[tap] / sum);
+            }
+        }
+    }
+}
+
+int Resampler::OutputFrames(int inputFrames) const
+{
+    return (int)(((Sint64)inputFrames * _upsampling + _downsampling - 1) / _downsampling);
+}
+
+void Resampler::Process(const Sint16 *input, Sint16 *output, int first, int last) const
+{
+    int stride = _taps * _channels;
+    for (int n = first; n < last; n++)
+    {
+        // Output frame n falls phase / _upsampling of the way from input frame 'frame' to the next
+        Sint64 position = (Sint64)n * _downsampling;
+        Sint64 frame = position / _upsampling;
+        int phase = (int)(position % _upsampling);
+
+        const Sint16 *window = input + (frame - _taps / 2 + 1) * _channels;
+        const float *coefficients = &_coefficients[(size_t)phase * stride];
+        Sint16 *out = output + (size_t)n * _channels;
+        if (_channels <= 2)
+        {
+            float sums[2];
+            _kernels.filter(window, coefficients, stride, sums);
+            if (_channels == 1)
+            {
+                out[0] = saturate(sums[0] + sums[1]);
+            }
+            else
+            {
+                out[0] = saturate(sums[0]);
+                out[1] = saturate(sums[1]);
+            }
+            continue;
+        }
+
+        for (int channel = 0; channel < _channels; channel++)
+        {
+            float sum = 0.0f;
+            for (int i = channel; i < stride; i += _channels)
+            {
+                sum += window[i] * coefficients[i];
+            }
+            out[channel] = saturate(sum);
+        }
+    }
+}
+
+int Resampler::SegmentThread(void *data)
+{
+    Segment *segment = (Segment *)data;
+    segment->resampler->Process(segment->input, segment->output, segment->first, segment->last);
+    return 0;
+}
+
+void Resampler::ProcessParallel(const Sint16 *input, int inputFrames, Sint16 *output, int threads) const
+{
+    int frames = OutputFrames(inputFrames);
+    int count = SDL_max(1, SDL_min(threads, frames / MIN_SEGMENT_FRAMES));
+
+    std::vector<Segment> segments(count);
+    std::vector<SDL_Thread *> workers(count, NULL);
+    for (int i = 0; i < count; i++)
+    {
+        segments[i] = { this, input, output, (int)((Sint64)frames * i / count), (int)((Sint64)frames * (i + 1) / count) };
+        if (i > 0)
+        {
+            workers[i] = SDL_CreateThread(SegmentThread, "resampler", &segments[i]);
+        }
+    }
+
+    // The calling thread takes the first segment, and any a thread could not be started for
+    SegmentThread(&segments[0]);
+    for (int i = 1; i < count; i++)
+    {
+        if (workers[i] != NULL)
+        {
+            SDL_WaitThread(workers[i], NULL);
+        }
+        else
+        {
+            SegmentThread(&segments[i]);
+        }
+    }
+}
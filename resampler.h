@@ -0,0 +1,62 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <vector>
+
+#include "SDL.h"
+#include "mixkernel.h"
+
+// Quality of the sample rate conversion done when samples are loaded
+enum ResampleQuality
+{
+    RESAMPLE_SDL,                              // SDL's own converter, as SDL_mixer uses it
+    RESAMPLE_FAST,                             // 16 taps per phase
+    RESAMPLE_MEDIUM,                           // 32 taps per phase
+    RESAMPLE_BEST                              // 64 taps per phase
+};
+
+// Polyphase windowed-sinc resampler for interleaved 16 bit samples. Every output frame
+// is computed from the input on its own, so a long input can be resampled in segments
+// on several threads and the segments line up exactly with a single-threaded run.
+class Resampler
+{
+public:
+    // Leaves the resampler invalid for rates whose ratio would need too many filter phases
+    Resampler(int inputRate, int outputRate, int channels, ResampleQuality quality, const MixKernels &kernels = BestMixKernels());
+
+    bool Valid() const { return !_coefficients.empty(); }
+
+    // Frames of silence the input needs before and after its audio
+    int Padding() const { return _taps; }
+
+    // Output frames the given number of input frames resample to
+    int OutputFrames(int inputFrames) const;
+
+    // Computes output frames first to last, excluding last; input points at the first
+    // frame of audio, with Padding() frames of silence on either side
+    void Process(const Sint16 *input, Sint16 *output, int first, int last) const;
+
+    // Computes all output frames, split into segments across up to the given number of threads
+    void ProcessParallel(const Sint16 *input, int inputFrames, Sint16 *output, int threads) const;
+
+private:
+    struct Segment
+    {
+        const Resampler *resampler;
+        const Sint16 *input;
+        Sint16 *output;
+        int first;
+        int last;
+    };
+
+    static int SegmentThread(void *data);
+
+    int _channels;
+    int _upsampling;                           // Output frames per _downsampling input frames, the filter phases
+    int _downsampling;
+    int _taps;                                 // Input frames each output frame is filtered from, a multiple of 8
+    std::vector<float> _coefficients;          // Per phase, each tap repeated for every channel
+    const MixKernels &_kernels;
+};
+
+#endif
@@ -1,33 +1,187 @@
+#include <sys/mman.h>
+
+#include <vector>
+
 #include "sample.h"
 #include "SDL_rwhttp.h"
 
 Sample::Sample(const char *uri)
 {
     sourceUri = uri;
-
-    this->initSample();
+    state = SAMPLE_LOADING;
+    refs = 0;
 }
 
 bool Sample::isValid()
 {
-    return this->chunk != NULL;
+    return this->state == SAMPLE_READY && this->chunk != NULL;
+}
+
+bool Sample::isLoading()
+{
+    return this->state == SAMPLE_LOADING;
 }
 
-void Sample::initSample()
+bool Sample::isRemote()
 {
-    bool isWeb = strncmp(this->sourceUri.c_str(), HTTP_PROTOCOL_PREFIX, strlen(HTTP_PROTOCOL_PREFIX)) == 0;
+    return strncmp(this->sourceUri.c_str(), HTTP_PROTOCOL_PREFIX, strlen(HTTP_PROTOCOL_PREFIX)) == 0;
+}
+
+// Decodes a WAV file at its own rate and resamples it to the output rate with the
+// in-house resampler. Returns NULL, with the source rewound, for anything it does not
+// handle, which SDL_mixer then decodes and converts itself: other formats, files already
+// at the output rate and rate ratios the resampler has no filter for.
+static Mix_Chunk *loadResampled(SDL_RWops *source, ResampleQuality quality, int threads)
+{
+    int frequency;
+    Uint16 format;
+    int channels;
+    Mix_QuerySpec(&frequency, &format, &channels);
+    if (source == NULL || quality == RESAMPLE_SDL || format != AUDIO_S16SYS)
+    {
+        return NULL;
+    }
+
+    Sint64 start = SDL_RWtell(source);
+    char header[12];
+    bool wav = SDL_RWread(source, header, 1, sizeof(header)) == sizeof(header) &&
+               memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0;
+    SDL_RWseek(source, start, RW_SEEK_SET);
+
+    SDL_AudioSpec spec;
+    Uint8 *data;
+    Uint32 length;
+    if (!wav || SDL_LoadWAV_RW(source, 0, &spec, &data, &length) == NULL)
+    {
+        SDL_RWseek(source, start, RW_SEEK_SET);
+        return NULL;
+    }
+
+    Resampler resampler(spec.freq, frequency, channels, quality);
+    SDL_AudioCVT cvt;
+    if (spec.freq == frequency || !resampler.Valid() ||
+        SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_S16SYS, channels, spec.freq) < 0)
+    {
+        SDL_FreeWAV(data);
+        SDL_RWseek(source, start, RW_SEEK_SET);
+        return NULL;
+    }
+
+    // Convert the format and channels at the input rate, in a buffer with room for the
+    // silence the filter reads past either end
+    int frameBytes = channels * 2;
+    size_t padding = (size_t)resampler.Padding() * frameBytes;
+    std::vector<Uint8> buffer(padding + (size_t)length * cvt.len_mult + padding);
+    memcpy(buffer.data() + padding, data, length);
+    SDL_FreeWAV(data);
+    cvt.buf = buffer.data() + padding;
+    cvt.len = length;
+    if (cvt.needed && SDL_ConvertAudio(&cvt) < 0)
+    {
+        SDL_RWseek(source, start, RW_SEEK_SET);
+        return NULL;
+    }
+    size_t converted = cvt.needed ? cvt.len_cvt : length;
+    memset(buffer.data() + padding + converted, 0, padding);
 
-    if (!isWeb)
+    // Allocated like SDL_mixer's own chunks, so Mix_FreeChunk() frees it
+    int inputFrames = (int)(converted / frameBytes);
+    int outputFrames = resampler.OutputFrames(inputFrames);
+    Mix_Chunk *chunk = (Mix_Chunk *)SDL_malloc(sizeof(Mix_Chunk));
+    Uint8 *output = (Uint8 *)SDL_malloc((size_t)outputFrames * frameBytes);
+    if (chunk == NULL || output == NULL)
     {
-        this->chunk = Mix_LoadWAV(this->sourceUri.c_str());
+        SDL_free(chunk);
+        SDL_free(output);
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    resampler.ProcessParallel((const Sint16 *)(buffer.data() + padding), inputFrames, (Sint16 *)output, threads);
+
+    chunk->allocated = 1;
+    chunk->abuf = output;
+    chunk->alen = (Uint32)outputFrames * frameBytes;
+    chunk->volume = MIX_MAX_VOLUME;
+    return chunk;
+}
+
+// PCM cache key of a source converted at the given quality; SDL's conversion keeps the
+// plain source identity, so entries cached before the resampler existed stay valid
+static std::string cacheKey(const std::string &identity, ResampleQuality quality)
+{
+    if (identity.empty() || quality == RESAMPLE_SDL)
+    {
+        return identity;
+    }
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "|resample%d", (int)quality);
+    return identity + suffix;
+}
+
+// Decodes the sample on the calling thread; the caller publishes the resulting state.
+// Remote samples are decoded from the already downloaded source if there is one.
+// With a PCM cache, previously converted samples are mapped instead of decoded.
+void Sample::Load(PcmCache *pcmCache, ResampleQuality quality, int resampleThreads)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::string key;
+
+    if (!this->isRemote())
+    {
+        if (pcmCache != NULL)
+        {
+            key = cacheKey(PcmCache::FileKey(this->sourceUri.c_str()), quality);
+            this->chunk = pcmCache->Load(key, &this->mapping, &this->mappingLength);
+        }
+        if (this->chunk == NULL)
+        {
+            SDL_RWops *source = SDL_RWFromFile(this->sourceUri.c_str(), "rb");
+            this->chunk = loadResampled(source, quality, resampleThreads);
+            if (this->chunk == NULL)
+            {
+                this->chunk = Mix_LoadWAV_RW(source, true);
+            }
+            else
+            {
+                SDL_RWclose(source);
+            }
+        }
     }
     else
     {
-        auto source = SDL_RWFromHttpSync(this->sourceUri.c_str());
-        printf("Retrieving %s from remote server...\n", this->sourceUri.c_str());
-        this->chunk = Mix_LoadWAV_RW(source, true);
+        SDL_RWops *source = this->source;
+        this->source = NULL;
+        if (source == NULL)
+        {
+            printf("Retrieving %s from remote server...\n", this->sourceUri.c_str());
+            source = SDL_RWFromHttpSync(this->sourceUri.c_str());
+        }
+        if (pcmCache != NULL && source != NULL)
+        {
+            key = cacheKey(PcmCache::DataKey(this->sourceUri.c_str(), source), quality);
+            this->chunk = pcmCache->Load(key, &this->mapping, &this->mappingLength);
+        }
+        if (this->chunk == NULL)
+        {
+            this->chunk = loadResampled(source, quality, resampleThreads);
+        }
+        if (this->chunk == NULL)
+        {
+            this->chunk = Mix_LoadWAV_RW(source, true);
+        }
+        else
+        {
+            SDL_RWclose(source);
+        }
+    }
+
+    if (pcmCache != NULL && this->chunk != NULL && this->mapping == NULL)
+    {
+        pcmCache->Store(key, this->chunk);
     }
 
+    this->loadTime = SDL_GetPerformanceCounter() - start;
+
     if (this->chunk == NULL)
     {
         fprintf(stderr, "Unable to load wave file: %s\n", this->sourceUri.c_str());
@@ -35,7 +189,8 @@ void Sample::initSample()
     }
     else
     {
-        printf("Loaded new sample %s successfully.\n", this->sourceUri.c_str());
+        printf("Loaded new sample %s successfully%s in %.1f ms.\n", this->sourceUri.c_str(), this->mapping != NULL ? " from the PCM cache" : "",
+               this->loadTime * 1000.0 / SDL_GetPerformanceFrequency());
     }
 }
 
@@ -43,4 +198,11 @@ void Sample::Free()
 {
     Mix_FreeChunk(this->chunk);
     this->chunk = NULL;
-}
\ No newline at end of file
+
+    if (this->mapping != NULL)
+    {
+        munmap(this->mapping, this->mappingLength);
+        this->mapping = NULL;
+        this->mappingLength = 0;
+    }
+}
@@ -1,14 +1,27 @@
 #ifndef SAMPLE_H
 #define SAMPLE_H
 
+#include <atomic>
+#include <list>
 #include <string>
 using namespace std;
 
 #include "SDL.h"
 #include "SDL_mixer.h"
 
+#include "pcmcache.h"
+#include "resampler.h"
+
 #define HTTP_PROTOCOL_PREFIX "http"
 
+// Load state of a sample; samples are created as loading and decoded by a loader thread
+enum SampleState
+{
+    SAMPLE_LOADING,
+    SAMPLE_READY,
+    SAMPLE_FAILED
+};
+
 class Sample
 {
 public:
@@ -16,12 +29,21 @@ public:
     Sample(const char *uri);
 
     bool isValid();
+    bool isLoading();
+    bool isRemote();
     Mix_Chunk *chunk = NULL;
-
+    SDL_RWops *source = NULL;  // Downloaded data waiting to be decoded, if any
+    void *mapping = NULL;      // PCM cache entry the chunk points into, if any
+    size_t mappingLength = 0;
+    Uint64 loadTime = 0;       // Performance counter ticks the last Load() took
+    std::atomic<SampleState> state;
+    std::atomic<int> refs;                 // Cache entry, active voices and pending plays using it
+    bool pinned = false;                   // Never evicted from the sample cache
+    bool cached = false;                   // Counted in the sample cache budget
+    std::list<Sample*>::iterator lruEntry; // Position in the cache's LRU list while cached
+
+    void Load(PcmCache *pcmCache, ResampleQuality quality, int resampleThreads);
     void Free();
-
-private:
-    void initSample();
 };
 
 #endif
@@ -1,46 +1,355 @@
 #include "samplemanager.h"
+#include "SDL_rwhttp.h"
 
-Sample* SampleManager::GetSample(const char * uri)
+bool SampleManager::StartLoaders(int threads)
 {
-    if (_database.find(uri) != _database.end())
+    _lock = SDL_CreateMutex();
+    _jobQueued = SDL_CreateCond();
+    _sampleLoaded = SDL_CreateCond();
+    _releaseLock = SDL_CreateMutex();
+    if (_lock == NULL || _jobQueued == NULL || _sampleLoaded == NULL || _releaseLock == NULL)
     {
-        return _database[uri];
+        fprintf(stderr, "Unable to create sample loader synchronization: %s\n", SDL_GetError());
+        return false;
     }
-    else
+
+    for (int i = 0; i < threads; i++)
     {
-        Sample* sample = new Sample(uri);
-        if (sample->isValid())
+        SDL_Thread *thread = SDL_CreateThread(LoaderThread, "loader", this);
+        if (thread == NULL)
         {
-            std::string key = uri;
-            _database.insert({key, sample});
-            return sample;
+            fprintf(stderr, "Unable to start sample loader thread: %s\n", SDL_GetError());
+            return false;
         }
-        else
+        _loaders.push_back(thread);
+    }
+
+    return true;
+}
+
+void SampleManager::StopLoaders()
+{
+    if (_lock == NULL)
+    {
+        return;
+    }
+
+    SDL_LockMutex(_lock);
+    _stopping = true;
+    SDL_CondBroadcast(_jobQueued);
+    SDL_UnlockMutex(_lock);
+
+    for (auto thread : _loaders)
+    {
+        SDL_WaitThread(thread, NULL);
+    }
+    _loaders.clear();
+}
+
+void SampleManager::SetLoadedCallback(SampleLoadedCallback callback, void *userData)
+{
+    _loadedCallback = callback;
+    _loadedUserData = userData;
+}
+
+void SampleManager::SetPcmCache(PcmCache *pcmCache)
+{
+    _pcmCache = pcmCache;
+}
+
+// Picks how samples are converted to the output rate; a long sample is split across threads
+void SampleManager::SetResampling(ResampleQuality quality, int threads)
+{
+    _resampleQuality = quality;
+    _resampleThreads = threads;
+}
+
+void SampleManager::SetBudget(size_t bytes)
+{
+    _budget = bytes;
+}
+
+// Keeps a sample in memory regardless of the budget
+void SampleManager::PinSample(Sample* sample)
+{
+    SDL_LockMutex(_lock);
+    sample->pinned = true;
+    SDL_UnlockMutex(_lock);
+}
+
+// Evicts least recently used samples until the cache fits its budget again.
+// Samples that are pinned or still referenced by a voice or pending play are skipped.
+void SampleManager::Trim()
+{
+    SDL_LockMutex(_lock);
+    auto it = _lru.end();
+    while (_budget > 0 && _bytes > _budget && it != _lru.begin())
+    {
+        Sample* sample = *--it;
+        if (sample->pinned || sample->refs > 1)
+        {
+            continue;
+        }
+
+        if (verbose)
+        {
+            printf("Evicting sample '%s' from cache (%u bytes).\n", sample->sourceUri.c_str(), sample->chunk->alen);
+        }
+
+        it = _lru.erase(it);
+        sample->cached = false;
+        _bytes -= sample->chunk->alen;
+        _evictions++;
+
+        _database.erase(sample->sourceUri);
+        Release(sample);
+    }
+    SDL_UnlockMutex(_lock);
+}
+
+// Takes a reference that keeps a sample alive after it leaves the cache
+void SampleManager::Retain(Sample* sample)
+{
+    sample->refs++;
+}
+
+// Drops a reference; the sample is freed by CollectReleased() once the last one is gone.
+// Safe to call from the audio thread.
+void SampleManager::Release(Sample* sample)
+{
+    if (--sample->refs == 0)
+    {
+        SDL_LockMutex(_releaseLock);
+        _released.push_back(sample);
+        SDL_UnlockMutex(_releaseLock);
+    }
+}
+
+// Frees samples that lost their last reference; must be called from the thread
+// that starts playback, since no other thread may take a new reference to them
+void SampleManager::CollectReleased()
+{
+    std::vector<Sample*> released;
+    SDL_LockMutex(_releaseLock);
+    released.swap(_released);
+    SDL_UnlockMutex(_releaseLock);
+
+    for (auto sample : released)
+    {
+        if (verbose)
         {
-        return 0;
+            printf("Freeing sample '%s'.\n", sample->sourceUri.c_str());
         }
+        sample->Free();
+        delete sample;
     }
 }
 
+SampleCacheStats SampleManager::GetStats()
+{
+    SDL_LockMutex(_lock);
+    SampleCacheStats stats = { _lru.size(), _bytes, _budget, _hits, _misses, _evictions };
+    SDL_UnlockMutex(_lock);
+    return stats;
+}
+
+int SampleManager::LoaderThread(void *data)
+{
+    ((SampleManager*)data)->LoaderLoop();
+    return 0;
+}
+
+void SampleManager::LoaderLoop()
+{
+    SDL_LockMutex(_lock);
+    while (!_stopping)
+    {
+        if (_jobs.empty())
+        {
+            SDL_CondWait(_jobQueued, _lock);
+            continue;
+        }
+
+        Sample* sample = _jobs.front();
+        _jobs.pop_front();
+
+        // Decode without holding the lock so other loaders and lookups keep going
+        SDL_UnlockMutex(_lock);
+        sample->Load(_pcmCache, _resampleQuality, _resampleThreads);
+        SDL_LockMutex(_lock);
+
+        FinishLoad(sample);
+    }
+    SDL_UnlockMutex(_lock);
+}
+
+// Publishes the outcome of a load; called with _lock held
+void SampleManager::FinishLoad(Sample* sample)
+{
+    sample->state = sample->chunk != NULL ? SAMPLE_READY : SAMPLE_FAILED;
+    if (sample->chunk != NULL)
+    {
+        _lru.push_front(sample);
+        sample->lruEntry = _lru.begin();
+        sample->cached = true;
+        _bytes += sample->chunk->alen;
+    }
+    SDL_CondBroadcast(_sampleLoaded);
+
+    if (_loadedCallback != NULL)
+    {
+        _loadedCallback(sample, _loadedUserData);
+    }
+}
+
+// Drops a sample from the budget accounting; called with _lock held
+void SampleManager::Uncache(Sample* sample)
+{
+    if (sample->cached)
+    {
+        _lru.erase(sample->lruEntry);
+        sample->cached = false;
+        _bytes -= sample->chunk->alen;
+    }
+}
+
+// Queues a sample for loading; called with _lock held.
+// Remote samples are downloaded concurrently first and only reach a loader thread
+// for decoding once their download has finished.
+void SampleManager::QueueLoad(Sample* sample)
+{
+    if (sample->isRemote())
+    {
+        PendingDownload *download = new PendingDownload { this, sample };
+        if (SDL_RWFromHttpAsync(sample->sourceUri.c_str(), DownloadFinished, download) == 0)
+        {
+            return;
+        }
+
+        fprintf(stderr, "Unable to queue download of '%s' (%s), downloading it on a loader thread.\n", sample->sourceUri.c_str(), SDL_GetError());
+        delete download;
+    }
+
+    _jobs.push_back(sample);
+    SDL_CondSignal(_jobQueued);
+}
+
+// Called on the download thread when a remote sample has been fetched
+void SampleManager::DownloadFinished(SDL_RWops *source, void *userData)
+{
+    PendingDownload *download = (PendingDownload*)userData;
+    SampleManager *manager = download->manager;
+    Sample *sample = download->sample;
+    delete download;
+
+    SDL_LockMutex(manager->_lock);
+    if (source == NULL)
+    {
+        fprintf(stderr, "Unable to download '%s': %s\n", sample->sourceUri.c_str(), SDL_GetError());
+        manager->FinishLoad(sample);
+    }
+    else
+    {
+        sample->source = source;
+        manager->_jobs.push_back(sample);
+        SDL_CondSignal(manager->_jobQueued);
+    }
+    SDL_UnlockMutex(manager->_lock);
+}
+
+// Returns the cache entry for a sample, queueing a background load on a miss.
+// Requests for a sample that is already loading attach to the in-flight load.
+Sample* SampleManager::RequestSample(const char * uri)
+{
+    SDL_LockMutex(_lock);
+
+    Sample* sample;
+    auto it = _database.find(uri);
+    if (it != _database.end())
+    {
+        sample = it->second;
+        if (sample->state != SAMPLE_FAILED)
+        {
+            if (sample->cached)
+            {
+                _lru.splice(_lru.begin(), _lru, sample->lruEntry);
+            }
+            _hits++;
+            SDL_UnlockMutex(_lock);
+            return sample;
+        }
+
+        // Retry samples that failed to load before
+        sample->state = SAMPLE_LOADING;
+    }
+    else
+    {
+        sample = new Sample(uri);
+        Retain(sample);  // Held by the cache entry
+        std::string key = uri;
+        _database.insert({key, sample});
+    }
+
+    _misses++;
+    QueueLoad(sample);
+    SDL_UnlockMutex(_lock);
+    return sample;
+}
+
+// Blocks until the given sample has finished loading; returns NULL if it failed
+Sample* SampleManager::WaitSample(Sample* sample)
+{
+    SDL_LockMutex(_lock);
+    while (sample->isLoading())
+    {
+        SDL_CondWait(_sampleLoaded, _lock);
+    }
+    SDL_UnlockMutex(_lock);
+
+    return sample->isValid() ? sample : 0;
+}
+
+Sample* SampleManager::GetSample(const char * uri)
+{
+    return WaitSample(RequestSample(uri));
+}
+
 void SampleManager::RemoveSample(const std::string& filename)
 {
+    SDL_LockMutex(_lock);
     auto it = _database.find(filename);
     if (it != _database.end())
     {
-        delete it->second;  // Libera la memoria asociada con el sample
-        _database.erase(it);  // Elimina la entrada del caché
-        if (verbose)
+        if (it->second->isLoading())
         {
-            printf("Sample '%s' removed from cache.\n", filename.c_str());
+            // A loader thread still owns it; later requests attach to that load instead
+            if (verbose)
+            {
+                printf("Sample '%s' is still loading, keeping it in cache.\n", filename.c_str());
+            }
+        }
+        else
+        {
+            // Voices still playing it keep their reference; the chunk is freed after the last one
+            Sample* sample = it->second;
+            Uncache(sample);
+            _database.erase(it);  // Elimina la entrada del caché
+            Release(sample);
+            if (verbose)
+            {
+                printf("Sample '%s' removed from cache.\n", filename.c_str());
+            }
         }
     }
+    SDL_UnlockMutex(_lock);
 }
 
 
 
 void SampleManager::FreeAll()
 {
+    CollectReleased();
     for( const auto& s : _database ) {
         s.second->Free();
     }
-}
\ No newline at end of file
+}
@@ -1,23 +1,87 @@
 #ifndef SAMPLEMANAGER_H
 #define SAMPLEMANAGER_H
 
+#include <deque>
+#include <list>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "sample.h"
 
 using namespace std;
 
+// Called on a loader thread whenever a sample finishes loading, successfully or not
+typedef void (*SampleLoadedCallback)(Sample *sample, void *userData);
+
+// Sample cache counters, as returned by SampleManager::GetStats()
+struct SampleCacheStats
+{
+    size_t samples;      // Decoded samples held in memory
+    size_t bytes;        // Decoded bytes held in memory
+    size_t budget;       // Max. decoded bytes, 0 if unlimited
+    Uint64 hits;         // Requests served by a loaded or loading sample
+    Uint64 misses;       // Requests that had to start a load
+    Uint64 evictions;    // Samples dropped to stay within the budget
+};
+
 class SampleManager {
 public:
     SampleManager(bool verbose) : verbose(verbose) {}
+    bool StartLoaders(int threads);
+    void StopLoaders();
+    void SetLoadedCallback(SampleLoadedCallback callback, void *userData);
+    void SetPcmCache(PcmCache *pcmCache);
+    void SetResampling(ResampleQuality quality, int threads);
+    void SetBudget(size_t bytes);
+    void PinSample(Sample* sample);
+    void Trim();
+    void Retain(Sample* sample);
+    void Release(Sample* sample);
+    void CollectReleased();
+    SampleCacheStats GetStats();
+    Sample* RequestSample(const char* uri);
+    Sample* WaitSample(Sample* sample);
     Sample* GetSample(const char* uri);
     void FreeAll();
     void RemoveSample(const std::string& filename);
 private:
+    // A remote sample whose download is in flight
+    struct PendingDownload
+    {
+        SampleManager *manager;
+        Sample *sample;
+    };
+
+    static int LoaderThread(void *data);
+    static void DownloadFinished(SDL_RWops *source, void *userData);
+    void LoaderLoop();
+    void QueueLoad(Sample* sample);
+    void FinishLoad(Sample* sample);
+    void Uncache(Sample* sample);
+
     std::unordered_map<std::string, Sample*> _database;
+    std::deque<Sample*> _jobs;             // Samples waiting for a loader thread
+    std::vector<SDL_Thread*> _loaders;     // Loader thread pool
+    SDL_mutex *_lock = NULL;               // Guards _database, _jobs and sample state changes
+    SDL_cond *_jobQueued = NULL;           // Signalled when a job is queued or the pool stops
+    SDL_cond *_sampleLoaded = NULL;        // Broadcast when any sample finishes loading
+    SDL_mutex *_releaseLock = NULL;        // Guards _released; never held while calling into SDL_mixer
+    std::vector<Sample*> _released;        // Samples that lost their last reference, waiting to be freed
+    bool _stopping = false;
+    PcmCache *_pcmCache = NULL;            // Converted sample cache, if enabled
+    ResampleQuality _resampleQuality = RESAMPLE_SDL;
+    int _resampleThreads = 1;              // Threads each sample is resampled on
+    std::list<Sample*> _lru;               // Loaded samples, most recently used first
+    size_t _bytes = 0;                     // Decoded bytes of the samples in _lru
+    size_t _budget = 0;                    // Max. decoded bytes before Trim() evicts, 0 if unlimited
+    Uint64 _hits = 0;
+    Uint64 _misses = 0;
+    Uint64 _evictions = 0;
+    SampleLoadedCallback _loadedCallback = NULL;
+    void *_loadedUserData = NULL;
     bool verbose;  // Almacena el valor de verbose
 };
 
 
-#endif
\ No newline at end of file
+#endif
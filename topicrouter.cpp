@@ -0,0 +1,96 @@
+#include "topicrouter.h"
+
+#include <string.h>
+
+void TopicRouter::Add(const std::string &pattern, int route)
+{
+    int node = 0;
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = pattern.find('/', start);
+        std::string level = pattern.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+        int child = -1;
+        if (level == "+")
+        {
+            child = _nodes[node].wildcard;
+        }
+        else
+        {
+            for (int candidate : _nodes[node].children)
+            {
+                if (_nodes[candidate].level == level)
+                {
+                    child = candidate;
+                    break;
+                }
+            }
+        }
+
+        if (child == -1)
+        {
+            child = _nodes.size();
+            _nodes.push_back(Node());
+            _nodes[child].level = level;
+            if (level == "+")
+            {
+                _nodes[node].wildcard = child;
+            }
+            else
+            {
+                _nodes[node].children.push_back(child);
+            }
+        }
+        node = child;
+
+        if (end == std::string::npos)
+        {
+            break;
+        }
+        start = end + 1;
+    }
+
+    _nodes[node].route = route;
+}
+
+int TopicRouter::Match(const char *topic, const char **parameter) const
+{
+    return MatchLevel(0, topic, parameter);
+}
+
+int TopicRouter::MatchLevel(int node, const char *level, const char **parameter) const
+{
+    const char *end = strchr(level, '/');
+    size_t length = end != NULL ? (size_t)(end - level) : strlen(level);
+
+    // A literal level takes precedence over a wildcard, which is still tried when the rest
+    // of the topic has no route under the literal one; only a route found stores a parameter
+    for (int child : _nodes[node].children)
+    {
+        const std::string &candidate = _nodes[child].level;
+        if (candidate.size() == length && memcmp(candidate.data(), level, length) == 0)
+        {
+            int route = end != NULL ? MatchLevel(child, end + 1, parameter) : _nodes[child].route;
+            if (route != -1)
+            {
+                return route;
+            }
+            break;
+        }
+    }
+
+    int wildcard = _nodes[node].wildcard;
+    if (wildcard == -1)
+    {
+        return -1;
+    }
+    const char *captured = NULL;
+    int route = end != NULL ? MatchLevel(wildcard, end + 1, &captured) : _nodes[wildcard].route;
+    if (route != -1)
+    {
+        // A wildcard further down the topic was captured later
+        *parameter = captured != NULL ? captured : level;
+    }
+    return route;
+}
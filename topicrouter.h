@@ -0,0 +1,38 @@
+#ifndef TOPICROUTER_H
+#define TOPICROUTER_H
+
+#include <string>
+#include <vector>
+
+// Routes MQTT topics to fast-path commands through a trie of topic levels that is
+// built once at startup. Matching walks the topic a level at a time, without
+// copying it or consulting the broker's wildcard matcher.
+class TopicRouter
+{
+public:
+    // Adds a route; a '+' level matches any single level and is captured as a parameter
+    void Add(const std::string &pattern, int route);
+
+    // Returns the route matching the topic, or -1 if there is none. The start of the
+    // last captured level, which ends at the next '/' or at the end of the topic,
+    // is stored in parameter.
+    int Match(const char *topic, const char **parameter) const;
+
+    bool IsEmpty() const { return _nodes.size() <= 1; }
+
+private:
+    // Matches the rest of the topic, from the given level on, below a node
+    int MatchLevel(int node, const char *level, const char **parameter) const;
+
+    struct Node
+    {
+        std::string level;
+        int route = -1;                // Route ending at this node, if any
+        int wildcard = -1;             // Child matching any level, if any
+        std::vector<int> children;     // Children matching a literal level
+    };
+
+    std::vector<Node> _nodes = std::vector<Node>(1);  // Node 0 is the root
+};
+
+#endif
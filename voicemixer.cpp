@@ -0,0 +1,336 @@
+#include "voicemixer.h"
+
+// Frames mixed at a time, so the float accumulator never has to grow on the audio thread
+#define BLOCK_FRAMES 1024
+
+// Frames a fade or volume ramp keeps the same gain for when mixing in 16 bits, which has no ramping kernel
+#define INT16_FADE_STEP 32
+
+VoiceMixer::VoiceMixer(int voices, int frequency, Accumulation accumulation, const MixKernels &kernels) :
+    _voices(voices), _frequency(frequency), _accumulation(accumulation), _kernels(kernels),
+    _accumulator(accumulation == ACCUMULATE_FLOAT ? BLOCK_FRAMES * 2 : 0)
+{
+}
+
+bool VoiceMixer::Play(int voice, const Sint16 *frames, int frameCount, int loops, int maxPlayLength, int delay)
+{
+    if (!Valid(voice) || frameCount <= 0)
+    {
+        return false;
+    }
+
+    Halt(voice);
+
+    Voice &v = _voices[voice];
+    v.frames = frames;
+    v.frameCount = frameCount;
+    v.position = 0;
+    v.loops = loops;
+    v.remaining = maxPlayLength > 0 ? (int)((Sint64)maxPlayLength * _frequency / 1000) : -1;
+    v.delay = delay;
+    v.left = 1.0f;
+    v.right = 1.0f;
+    v.fadeLength = 0;
+    v.fadeRemaining = 0;
+    v.fadeFrom = 1.0f;
+    v.fadeDelay = 0;
+    v.paused = false;
+    v.playing = true;
+    return true;
+}
+
+void VoiceMixer::Halt(int voice)
+{
+    if (voice == -1)
+    {
+        for (int i = 0; i < (int)_voices.size(); i++)
+        {
+            Halt(i);
+        }
+    }
+    else if (Valid(voice) && _voices[voice].playing)
+    {
+        Finish(voice);
+    }
+}
+
+void VoiceMixer::FadeOut(int voice, int ms, int delay)
+{
+    if (voice == -1)
+    {
+        for (int i = 0; i < (int)_voices.size(); i++)
+        {
+            FadeOut(i, ms, delay);
+        }
+        return;
+    }
+    if (!Valid(voice) || !_voices[voice].playing)
+    {
+        return;
+    }
+
+    int frames = (int)((Sint64)ms * _frequency / 1000);
+    if (delay > 0)
+    {
+        _voices[voice].fadeDelay = delay;
+        _voices[voice].fadeFrames = frames;
+        return;
+    }
+    StartFade(voice, frames);
+}
+
+void VoiceMixer::StartFade(int index, int frames)
+{
+    if (frames <= 0)
+    {
+        Finish(index);
+        return;
+    }
+
+    // Like SDL_mixer, a fade out of a fading voice starts over from its current gain
+    Voice &v = _voices[index];
+    if (v.fadeLength > 0)
+    {
+        v.fadeFrom *= (float)v.fadeRemaining / v.fadeLength;
+    }
+    v.fadeLength = frames;
+    v.fadeRemaining = frames;
+}
+
+void VoiceMixer::SetVolume(int voice, float volume)
+{
+    if (voice == -1)
+    {
+        for (auto &v : _voices)
+        {
+            v.volume.Set(volume);
+        }
+    }
+    else if (Valid(voice))
+    {
+        _voices[voice].volume.Set(volume);
+    }
+}
+
+void VoiceMixer::Ramp(int voice, float volume, int ms, RampCurve curve, int delay)
+{
+    int frames = (int)((Sint64)ms * _frequency / 1000);
+    if (voice == -1)
+    {
+        for (auto &v : _voices)
+        {
+            v.volume.Start(volume, frames, curve, delay);
+        }
+    }
+    else if (Valid(voice))
+    {
+        _voices[voice].volume.Start(volume, frames, curve, delay);
+    }
+}
+
+void VoiceMixer::Pause(int voice)
+{
+    if (voice == -1)
+    {
+        for (auto &v : _voices)
+        {
+            v.paused = true;
+        }
+    }
+    else if (Valid(voice))
+    {
+        _voices[voice].paused = true;
+    }
+}
+
+void VoiceMixer::Resume(int voice)
+{
+    if (voice == -1)
+    {
+        for (auto &v : _voices)
+        {
+            v.paused = false;
+        }
+    }
+    else if (Valid(voice))
+    {
+        _voices[voice].paused = false;
+    }
+}
+
+void VoiceMixer::SetPanning(int voice, float left, float right)
+{
+    if (Valid(voice))
+    {
+        _voices[voice].left = left;
+        _voices[voice].right = right;
+    }
+}
+
+bool VoiceMixer::Playing(int voice) const
+{
+    return Valid(voice) && _voices[voice].playing;
+}
+
+bool VoiceMixer::Fading(int voice) const
+{
+    return Playing(voice) && (_voices[voice].fadeLength > 0 || _voices[voice].fadeDelay > 0);
+}
+
+void VoiceMixer::SetVoices(int voices)
+{
+    for (int i = voices; i < (int)_voices.size(); i++)
+    {
+        Halt(i);
+    }
+    _voices.resize(voices);
+}
+
+void VoiceMixer::Mix(Sint16 *stream, int frames)
+{
+    while (frames > 0)
+    {
+        int block = SDL_min(frames, BLOCK_FRAMES);
+        MixBlock(stream, block);
+        stream += 2 * block;
+        frames -= block;
+    }
+}
+
+void VoiceMixer::MixBlock(Sint16 *stream, int frames)
+{
+    if (_accumulation == ACCUMULATE_FLOAT)
+    {
+        // Start from what SDL_mixer mixed, such as streamed music
+        _kernels.toFloat(_accumulator.data(), stream, 2 * frames);
+    }
+
+    for (int i = 0; i < (int)_voices.size(); i++)
+    {
+        if (_voices[i].playing && !_voices[i].paused)
+        {
+            MixVoice(i, stream, frames);
+        }
+    }
+
+    if (_accumulation == ACCUMULATE_FLOAT)
+    {
+        _kernels.toInt16(stream, _accumulator.data(), 2 * frames);
+    }
+}
+
+void VoiceMixer::MixVoice(int index, Sint16 *stream, int frames)
+{
+    Voice &v = _voices[index];
+
+    int offset = 0;
+    while (offset < frames && v.playing)
+    {
+        // Go up to the end of the output, the start delay or else the sample and the play
+        // length, the fade or its delay, or the straight piece of the volume ramp, whichever
+        // comes first. The volume and the fade move on through the start delay, so they
+        // change on their own frame whether the voice has started by then or not.
+        int count = frames - offset;
+        if (v.delay > 0)
+        {
+            count = SDL_min(count, v.delay);
+        }
+        else
+        {
+            count = SDL_min(count, v.frameCount - v.position);
+            if (v.remaining >= 0)
+            {
+                count = SDL_min(count, v.remaining);
+            }
+        }
+        if (v.fadeDelay > 0)
+        {
+            count = SDL_min(count, v.fadeDelay);
+        }
+        if (v.fadeLength > 0)
+        {
+            count = SDL_min(count, v.fadeRemaining);
+        }
+        if (_accumulation == ACCUMULATE_INT16 && v.delay == 0 && (v.fadeLength > 0 || v.volume.Ramping()))
+        {
+            count = SDL_min(count, INT16_FADE_STEP);
+        }
+
+        float gain;
+        float step;
+        count = v.volume.Next(count, &gain, &step);
+        if (v.fadeLength > 0)
+        {
+            // The product of the ramp and the fade, exact at both ends of the piece
+            float from = v.fadeFrom * v.fadeRemaining / v.fadeLength;
+            float to = v.fadeFrom * (v.fadeRemaining - count) / v.fadeLength;
+            float end = (gain + step * count) * to;
+            gain *= from;
+            step = (end - gain) / count;
+        }
+
+        if (v.delay > 0)
+        {
+            v.delay -= count;
+        }
+        else
+        {
+            const Sint16 *source = v.frames + 2 * v.position;
+            if (_accumulation == ACCUMULATE_FLOAT)
+            {
+                StereoGain stereo = { gain * v.left, gain * v.right, step * v.left, step * v.right };
+                _kernels.mixFloat(_accumulator.data() + 2 * offset, source, count, stereo);
+            }
+            else
+            {
+                _kernels.mixInt16(stream + 2 * offset, source, count, gain * v.left, gain * v.right);
+            }
+
+            v.position += count;
+            if (v.remaining > 0)
+            {
+                v.remaining -= count;
+            }
+        }
+        offset += count;
+        if (v.fadeLength > 0)
+        {
+            v.fadeRemaining -= count;
+        }
+
+        if (v.position == v.frameCount)
+        {
+            if (v.loops == 0)
+            {
+                Finish(index);
+                break;
+            }
+            v.position = 0;
+            if (v.loops > 0)
+            {
+                v.loops--;
+            }
+        }
+        if (v.remaining == 0 || (v.fadeLength > 0 && v.fadeRemaining == 0))
+        {
+            Finish(index);
+        }
+        else if (v.fadeDelay > 0)
+        {
+            v.fadeDelay -= count;
+            if (v.fadeDelay == 0)
+            {
+                StartFade(index, v.fadeFrames);
+            }
+        }
+    }
+}
+
+void VoiceMixer::Finish(int index)
+{
+    _voices[index].playing = false;
+    if (_finished != NULL)
+    {
+        _finished(index);
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef VOICEMIXER_H
+#define VOICEMIXER_H
+
+#include <vector>
+
+#include "SDL.h"
+#include "gainramp.h"
+#include "mixkernel.h"
+
+// In-house replacement for SDL_mixer's channels, for large voice counts: mixes
+// samples already converted to the output format into interleaved stereo 16 bit
+// output with vectorized kernels, applying each voice's gain, pan and fade.
+// It runs from SDL_mixer's post-mix callback, on top of whatever SDL_mixer mixed
+// itself, so every method has to be called with the mixer locked.
+class VoiceMixer
+{
+public:
+    enum Accumulation
+    {
+        ACCUMULATE_FLOAT,                      // Sum all voices in floats, saturate once
+        ACCUMULATE_INT16                       // Saturate after every voice, like SDL_mixer
+    };
+
+    // Called when a voice stops playing, from Mix() or from the method that stopped it
+    typedef void (*FinishedCallback)(int voice);
+
+    VoiceMixer(int voices, int frequency, Accumulation accumulation, const MixKernels &kernels = BestMixKernels());
+
+    void SetFinishedCallback(FinishedCallback callback) { _finished = callback; }
+
+    // Starts a voice on interleaved stereo frames, replacing what it played. Loops is the
+    // number of repeats, -1 for forever; maxPlayLength is in ms, -1 for no limit. The
+    // voice stays silent for delay frames before it starts.
+    bool Play(int voice, const Sint16 *frames, int frameCount, int loops, int maxPlayLength, int delay);
+
+    // These apply to every voice if voice is -1. Fades and ramps start after delay frames,
+    // which count from the next frame mixed whether the voice has started by then or not;
+    // a fade out of no length halts the voice then.
+    void Halt(int voice);
+    void FadeOut(int voice, int ms, int delay = 0);
+    void SetVolume(int voice, float volume);
+    void Ramp(int voice, float volume, int ms, RampCurve curve, int delay = 0);
+    void Pause(int voice);
+    void Resume(int voice);
+
+    // Gains of the left and right output, reset to 1 whenever the voice starts
+    void SetPanning(int voice, float left, float right);
+
+    // Whether a voice is playing, paused or not, and whether it is fading out or due to
+    bool Playing(int voice) const;
+    bool Fading(int voice) const;
+
+    // Changes the number of voices, halting the ones dropped
+    void SetVoices(int voices);
+    int Voices() const { return (int)_voices.size(); }
+    const MixKernels &Kernels() const { return _kernels; }
+
+    // Adds the playing voices to interleaved stereo 16 bit output
+    void Mix(Sint16 *stream, int frames);
+
+private:
+    struct Voice
+    {
+        const Sint16 *frames = NULL;
+        int frameCount = 0;
+        int position = 0;                      // Next frame to play
+        int loops = 0;
+        int remaining = -1;                    // Frames left before maxPlayLength, -1 if unlimited
+        int delay = 0;                         // Silent frames left before the voice starts
+        GainRamp volume;
+        float left = 1.0f;
+        float right = 1.0f;
+        int fadeLength = 0;                    // Frames of the fade out, 0 if not fading
+        int fadeRemaining = 0;
+        float fadeFrom = 1.0f;                 // Share of the volume the fade out starts from
+        int fadeDelay = 0;                     // Frames left before a scheduled fade out starts, 0 if none
+        int fadeFrames = 0;                    // Length of the scheduled fade out
+        bool playing = false;
+        bool paused = false;
+    };
+
+    void MixBlock(Sint16 *stream, int frames);
+    void MixVoice(int index, Sint16 *stream, int frames);
+    void StartFade(int index, int frames);
+    void Finish(int index);
+    bool Valid(int voice) const { return voice >= 0 && voice < (int)_voices.size(); }
+
+    std::vector<Voice> _voices;
+    int _frequency;
+    Accumulation _accumulation;
+    const MixKernels &_kernels;
+    std::vector<float> _accumulator;           // One block of output while mixing in floats
+    FinishedCallback _finished = NULL;
+};
+
+#endif